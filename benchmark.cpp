@@ -0,0 +1,345 @@
+/*
+    ShoobyDB micro benchmarks
+
+    build and run:
+    g++ -std=c++20 -O2 -pthread benchmark.cpp -o shooby_bench && ./shooby_bench [backend_latency_us] [max_threads]
+
+    compare locking modes by adding e.g. -DSHOOBY_LOCK_STRIPES=64 or -DSHOOBY_SEQLOCK_READS=1
+*/
+
+#include "shooby_db.h"
+#include "shooby_metamap.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+// ================== BENCHMARK META MAPS =================
+// generated uint32_t entries named PREFIX + octal index, e.g. KEY_00 ... KEY_77 for 64 entries
+
+#define BENCH_8(CONFIG_NUM, PREFIX)    \
+    CONFIG_NUM(PREFIX##0, uint32_t, 0) \
+    CONFIG_NUM(PREFIX##1, uint32_t, 1) \
+    CONFIG_NUM(PREFIX##2, uint32_t, 2) \
+    CONFIG_NUM(PREFIX##3, uint32_t, 3) \
+    CONFIG_NUM(PREFIX##4, uint32_t, 4) \
+    CONFIG_NUM(PREFIX##5, uint32_t, 5) \
+    CONFIG_NUM(PREFIX##6, uint32_t, 6) \
+    CONFIG_NUM(PREFIX##7, uint32_t, 7)
+
+#define BENCH_64(CONFIG_NUM, PREFIX) \
+    BENCH_8(CONFIG_NUM, PREFIX##0)   \
+    BENCH_8(CONFIG_NUM, PREFIX##1)   \
+    BENCH_8(CONFIG_NUM, PREFIX##2)   \
+    BENCH_8(CONFIG_NUM, PREFIX##3)   \
+    BENCH_8(CONFIG_NUM, PREFIX##4)   \
+    BENCH_8(CONFIG_NUM, PREFIX##5)   \
+    BENCH_8(CONFIG_NUM, PREFIX##6)   \
+    BENCH_8(CONFIG_NUM, PREFIX##7)
+
+#define BENCH_512(CONFIG_NUM, PREFIX) \
+    BENCH_64(CONFIG_NUM, PREFIX##0)   \
+    BENCH_64(CONFIG_NUM, PREFIX##1)   \
+    BENCH_64(CONFIG_NUM, PREFIX##2)   \
+    BENCH_64(CONFIG_NUM, PREFIX##3)   \
+    BENCH_64(CONFIG_NUM, PREFIX##4)   \
+    BENCH_64(CONFIG_NUM, PREFIX##5)   \
+    BENCH_64(CONFIG_NUM, PREFIX##6)   \
+    BENCH_64(CONFIG_NUM, PREFIX##7)
+
+#define BENCH_4096(CONFIG_NUM, PREFIX) \
+    BENCH_512(CONFIG_NUM, PREFIX##0)   \
+    BENCH_512(CONFIG_NUM, PREFIX##1)   \
+    BENCH_512(CONFIG_NUM, PREFIX##2)   \
+    BENCH_512(CONFIG_NUM, PREFIX##3)   \
+    BENCH_512(CONFIG_NUM, PREFIX##4)   \
+    BENCH_512(CONFIG_NUM, PREFIX##5)   \
+    BENCH_512(CONFIG_NUM, PREFIX##6)   \
+    BENCH_512(CONFIG_NUM, PREFIX##7)
+
+#define Bench8(CONFIG_NUM, CONFIG_STR, CONFIG_BLOB) BENCH_8(CONFIG_NUM, KEY_)
+#define Bench64(CONFIG_NUM, CONFIG_STR, CONFIG_BLOB) BENCH_64(CONFIG_NUM, KEY_)
+#define Bench512(CONFIG_NUM, CONFIG_STR, CONFIG_BLOB) BENCH_512(CONFIG_NUM, KEY_)
+#define Bench4096(CONFIG_NUM, CONFIG_STR, CONFIG_BLOB) BENCH_4096(CONFIG_NUM, KEY_)
+
+DEFINE_SHOOBY_META_MAP(Bench8)
+DEFINE_SHOOBY_META_MAP(Bench64)
+DEFINE_SHOOBY_META_MAP(Bench512)
+DEFINE_SHOOBY_META_MAP(Bench4096)
+
+struct BenchBlob
+{
+    uint32_t words[16]{};
+};
+
+#define BenchMixed(CONFIG_NUM, CONFIG_STR, CONFIG_BLOB) \
+    CONFIG_NUM(NUMBER, uint32_t, 0)                     \
+    CONFIG_STR(NAME, "shooby", 32)                      \
+    CONFIG_BLOB(BLOB, BenchBlob, BenchBlob{})           \
+    BENCH_8(CONFIG_NUM, KEY_)
+
+DEFINE_SHOOBY_META_MAP(BenchMixed)
+
+// observers can't be removed, so every observer count gets its own DB
+#define BenchObservers0(CONFIG_NUM, CONFIG_STR, CONFIG_BLOB) BENCH_8(CONFIG_NUM, KEY_)
+#define BenchObservers1(CONFIG_NUM, CONFIG_STR, CONFIG_BLOB) BENCH_8(CONFIG_NUM, KEY_)
+#define BenchObservers16(CONFIG_NUM, CONFIG_STR, CONFIG_BLOB) BENCH_8(CONFIG_NUM, KEY_)
+#define BenchBackend(CONFIG_NUM, CONFIG_STR, CONFIG_BLOB) BENCH_8(CONFIG_NUM, KEY_)
+
+DEFINE_SHOOBY_META_MAP(BenchObservers0)
+DEFINE_SHOOBY_META_MAP(BenchObservers1)
+DEFINE_SHOOBY_META_MAP(BenchObservers16)
+DEFINE_SHOOBY_META_MAP(BenchBackend)
+
+using namespace std;
+
+// ================== MEASUREMENT =================
+
+// keeps the compiler from optimizing away the benchmarked reads
+static volatile uint32_t g_sink = 0;
+
+struct Latency
+{
+    double mean_ns;
+    double p50_ns;
+    double p99_ns;
+    double p999_ns;
+};
+
+// times samples of batch calls each, percentiles are of the per call time inside a sample
+template <class F>
+Latency measure(F &&f, size_t samples = 20'000, size_t batch = 32)
+{
+    vector<double> per_call(samples);
+    size_t i = 0;
+    for (size_t sample = 0; sample < samples; sample++)
+    {
+        auto start = chrono::steady_clock::now();
+        for (size_t b = 0; b < batch; b++)
+            f(i++);
+        auto end = chrono::steady_clock::now();
+        per_call[sample] = chrono::duration<double, nano>(end - start).count() / batch;
+    }
+
+    double mean = 0;
+    for (double ns : per_call)
+        mean += ns;
+    mean /= samples;
+
+    sort(per_call.begin(), per_call.end());
+    auto percentile = [&](double p)
+    { return per_call[min(samples - 1, size_t(p * samples))]; };
+
+    return Latency{mean, percentile(0.5), percentile(0.99), percentile(0.999)};
+}
+
+void print_header(const char *title)
+{
+    printf("\n--- %s ---\n", title);
+    printf("%-40s %10s %10s %10s %10s\n", "", "mean ns", "p50 ns", "p99 ns", "p99.9 ns");
+}
+
+void print_latency(const char *name, const Latency &latency)
+{
+    printf("%-40s %10.1f %10.1f %10.1f %10.1f\n", name, latency.mean_ns, latency.p50_ns, latency.p99_ns, latency.p999_ns);
+}
+
+// runs op(thread_index, i) on 1, 2, 4 ... max_threads threads and prints the total throughput
+template <class F>
+void measure_throughput(const char *name, size_t max_threads, F &&op)
+{
+    static constexpr size_t OPS_PER_THREAD = 1'000'000;
+
+    printf("%-40s", name);
+    for (size_t threads = 1; threads <= max_threads; threads *= 2)
+    {
+        vector<thread> workers;
+        auto start = chrono::steady_clock::now();
+        for (size_t t = 0; t < threads; t++)
+        {
+            workers.emplace_back([t, &op]
+                                 {
+                for (size_t i = 0; i < OPS_PER_THREAD; i++)
+                    op(t, i); });
+        }
+
+        for (auto &worker : workers)
+            worker.join();
+
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        printf(" %zuT: %7.2f", threads, (threads * OPS_PER_THREAD) / seconds / 1e6);
+    }
+    printf("  (Mops/s)\n");
+}
+
+// ================== FAKES =================
+
+template <class E>
+class NopObserver final : public Shooby::DB<E>::IObserver
+{
+public:
+    void OnSet(E::enum_type e, bool changed) override { g_sink = g_sink + changed; }
+};
+
+class LatencyBackend final : public Shooby::IBackend
+{
+public:
+    explicit LatencyBackend(uint32_t latency_us) : latency(latency_us) {}
+
+    void Save(const char *e_name, const void *data, size_t size) override
+    {
+        // busy wait, sleeping has a much coarser resolution than a fast flash write
+        auto until = chrono::steady_clock::now() + chrono::microseconds(latency);
+        while (chrono::steady_clock::now() < until)
+            ;
+    }
+
+    bool Load(const char *e_name, void *data, size_t size) override { return false; }
+
+private:
+    uint32_t latency;
+};
+
+// ================== BENCHMARKS =================
+
+// per call cost of Get must not depend on the size of the map or the position of the key in it
+template <class E>
+void bench_map_size()
+{
+    using BenchDB = Shooby::DB<E>;
+    BenchDB::Init();
+
+    auto first = static_cast<E::enum_type>(0);
+    auto last = static_cast<E::enum_type>(E::NUM - 1);
+    char name[64];
+
+    snprintf(name, sizeof(name), "%s Get first key", E::name);
+    print_latency(name, measure([&](size_t)
+                                { g_sink = BenchDB::template Get<uint32_t>(first); }));
+
+    snprintf(name, sizeof(name), "%s Get last key", E::name);
+    print_latency(name, measure([&](size_t)
+                                { g_sink = BenchDB::template Get<uint32_t>(last); }));
+
+    snprintf(name, sizeof(name), "%s Set last key", E::name);
+    print_latency(name, measure([&](size_t i)
+                                { BenchDB::Set(last, uint32_t(i)); }));
+
+    struct SinkVisitor
+    {
+        void operator()(E::enum_type, Shooby::value_variant_t &value) { g_sink = std::get<uint32_t>(value); }
+    } visitor;
+
+    snprintf(name, sizeof(name), "%s VisitEach", E::name);
+    print_latency(name, measure([&](size_t)
+                                { BenchDB::VisitEach(visitor); },
+                                200, 1));
+}
+
+void bench_value_types()
+{
+    using BenchDB = Shooby::DB<BenchMixed>;
+    using enum BenchMixed::enum_type;
+    BenchDB::Init();
+
+    print_header("value types");
+    print_latency("Get arithmetic", measure([](size_t)
+                                            { g_sink = BenchDB::Get<uint32_t>(NUMBER); }));
+    print_latency("Set arithmetic", measure([](size_t i)
+                                            { BenchDB::Set(NUMBER, uint32_t(i)); }));
+
+    print_latency("Get string pointer", measure([](size_t)
+                                                { g_sink = BenchDB::Get<const char *>(NAME)[0]; }));
+    print_latency("GetString", measure([](size_t)
+                                       { g_sink = BenchDB::GetString<NAME>().c_str()[0]; }));
+    print_latency("Set string", measure([](size_t i)
+                                        { BenchDB::Set(NAME, (i & 1) ? "shooby" : "dooby"); }));
+
+    BenchBlob blob;
+    print_latency("Get blob (64 bytes)", measure([](size_t)
+                                                 { g_sink = BenchDB::Get<BenchBlob>(BLOB).words[0]; }));
+    print_latency("Set blob (64 bytes)", measure([&blob](size_t i)
+                                                 { blob.words[0] = i; BenchDB::Set(BLOB, blob); }));
+}
+
+template <class E>
+void bench_observers(const char *name, size_t observer_count)
+{
+    using BenchDB = Shooby::DB<E>;
+    static vector<NopObserver<E>> observers(observer_count);
+
+    BenchDB::Init();
+    for (auto &observer : observers)
+        BenchDB::SetObserver(&observer);
+
+    auto e = static_cast<E::enum_type>(0);
+    print_latency(name, measure([e](size_t i)
+                                { BenchDB::Set(e, uint32_t(i)); }));
+}
+
+void bench_backend(uint32_t latency_us)
+{
+    using BenchDB = Shooby::DB<BenchBackend>;
+    static LatencyBackend backend(latency_us);
+    BenchDB::Init(&backend);
+
+    char name[64];
+    snprintf(name, sizeof(name), "Set, backend save %uus", latency_us);
+    print_latency(name, measure([](size_t i)
+                                { BenchDB::Set(BenchBackend::KEY_0, uint32_t(i)); },
+                                2'000, 1));
+}
+
+void bench_threads(size_t max_threads)
+{
+    using BenchDB = Shooby::DB<Bench64>;
+
+    printf("\n--- multi thread throughput (SHOOBY_LOCK_STRIPES=%d SHOOBY_SEQLOCK_READS=%d) ---\n",
+           SHOOBY_LOCK_STRIPES, SHOOBY_SEQLOCK_READS);
+
+    measure_throughput("Get same key", max_threads, [](size_t, size_t)
+                       { g_sink = BenchDB::Get<uint32_t>(Bench64::KEY_00); });
+
+    // every thread hits its own key, with a single DB mutex all threads serialize
+    measure_throughput("Get disjoint keys", max_threads, [](size_t t, size_t)
+                       { g_sink = BenchDB::Get<uint32_t>(static_cast<Bench64::enum_type>(t % Bench64::NUM)); });
+
+    measure_throughput("Set disjoint keys", max_threads, [](size_t t, size_t i)
+                       { BenchDB::Set(static_cast<Bench64::enum_type>(t % Bench64::NUM), uint32_t(i)); });
+
+    measure_throughput("75% Get 25% Set disjoint keys", max_threads, [](size_t t, size_t i)
+                       {
+        auto e = static_cast<Bench64::enum_type>(t % Bench64::NUM);
+        if (i % 4 == 0)
+            BenchDB::Set(e, uint32_t(i));
+        else
+            g_sink = BenchDB::Get<uint32_t>(e); });
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t backend_latency_us = argc > 1 ? atoi(argv[1]) : 100;
+    size_t max_threads = argc > 2 ? atoi(argv[2]) : max(4u, thread::hardware_concurrency());
+
+    print_header("map size");
+    bench_map_size<Bench8>();
+    bench_map_size<Bench64>();
+    bench_map_size<Bench512>();
+    bench_map_size<Bench4096>();
+
+    bench_value_types();
+
+    print_header("observers");
+    bench_observers<BenchObservers0>("Set, 0 observers", 0);
+    bench_observers<BenchObservers1>("Set, 1 observer", 1);
+    bench_observers<BenchObservers16>("Set, 16 observers", 16);
+
+    print_header("backend");
+    bench_backend(backend_latency_us);
+
+    bench_threads(max_threads);
+
+    return 0;
+}
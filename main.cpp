@@ -1,6 +1,11 @@
 #include "shooby_db.h"
 #include "shooby_metamap.h"
+#include "shooby_log_backend.h"
 #include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 
 struct Bl
 {
@@ -87,6 +92,17 @@ void test_string()
 
     safe_fixed_str = DB::GetString<SOME_STRING>();
     test_equals(unsafe_str, safe_fixed_str.c_str());
+    test_equals(safe_fixed_str.size(), size_t(5));
+
+    // string views carry their length, no NUL needed
+    std::string_view view = "HELLO WORLD";
+    test_equals(DB::Set(SOME_STRING, view), true);
+    test_equals(DB::Get<std::string_view>(SOME_STRING), view);
+    test_equals(DB::GetString<SOME_STRING>().view(), view);
+
+    test_equals(DB::Set(SOME_STRING, view.substr(0, 5)), true);
+    test_equals(DB::Get<std::string_view>(SOME_STRING), std::string_view("HELLO"));
+    test_equals(DB::Set(SOME_STRING, view.substr(0, 5)), false);
 
     cout << "TEST PASSED" << endl;
 }
@@ -146,7 +162,7 @@ void test_bool()
     cout << "TEST PASSED" << endl;
 }
 
-class Observer final : public Shooby::DB<Dooby>::IObserver
+class Observer final : public DB::IObserver
 {
 public:
     void OnSet(Dooby::enum_type type, bool changed) override
@@ -154,10 +170,43 @@ public:
         cout << "observer #" << this_observer << " OnSet " << Dooby::get_name(type) << (changed ? " changed" : " not changed") << endl;
     }
 
+    void OnSetMany(const DB::KeySet &keys, const DB::KeySet &changed) override
+    {
+        cout << "observer #" << this_observer << " OnSetMany " << keys.count() << " keys, " << changed.count() << " changed" << endl;
+    }
+
     static inline int observers{};
     int this_observer = ++observers;
 };
 
+class CountingObserver final : public DB::IObserver
+{
+public:
+    void OnSet(Dooby::enum_type type, bool changed) override { calls++; }
+    int calls = 0;
+};
+
+// counts the saves reaching the backend, every value is found on load
+class CountingBackend final : public Shooby::IBackend
+{
+public:
+    void Save(const char *e_name, const void *data, size_t size) override { saves++; }
+
+    void SaveBatch(std::span<const Shooby::BackendEntry> entries) override
+    {
+        batches++;
+        batch.clear();
+        for (const Shooby::BackendEntry &entry : entries)
+            batch.push_back(entry.name);
+    }
+
+    bool Load(const char *e_name, void *data, size_t size) override { return true; }
+
+    int saves = 0;
+    int batches = 0;
+    std::vector<std::string> batch{}; // names of the last batch, in order
+};
+
 class Backend final : public Shooby::IBackend
 {
 public:
@@ -166,6 +215,11 @@ public:
         cout << "Backend Saved " << e_name << endl;
     }
 
+    void SaveBatch(std::span<const Shooby::BackendEntry> entries) override
+    {
+        cout << "Backend Saved batch of " << entries.size() << endl;
+    }
+
     bool Load(const char *e_name, void *data, size_t size) override
     {
         cout << "Backend Loaded " << e_name << endl;
@@ -173,6 +227,44 @@ public:
     }
 };
 
+// keeps the data buffer image in memory, per name loads always fail
+class ImageBackend final : public Shooby::IBackend
+{
+public:
+    void Save(const char *e_name, const void *data, size_t size) override {}
+    bool Load(const char *e_name, void *data, size_t size) override { return false; }
+
+    bool LoadImage(uint32_t fp, void *data, size_t size) override
+    {
+        if (fp != fingerprint || image.size() != size)
+            return false;
+
+        memcpy(data, image.data(), size);
+        return true;
+    }
+
+    bool SaveImage(uint32_t fp, size_t offset, const void *data, size_t size) override
+    {
+        if (fail_saves)
+            return false;
+
+        fingerprint = fp;
+        if (image.size() < offset + size)
+            image.resize(offset + size);
+
+        memcpy(image.data() + offset, data, size);
+        image_saves++;
+        return true;
+    }
+
+    void InvalidateImage() override { image.clear(); }
+
+    uint32_t fingerprint = 0;
+    vector<uint8_t> image;
+    int image_saves = 0;
+    bool fail_saves = false;
+};
+
 class Visitor
 {
 public:
@@ -247,6 +339,692 @@ void range_tests()
     test_equals(success, true);
 }
 
+void transaction_test()
+{
+    DB::Transaction transaction;
+    test_equals(transaction.Set<uint16_t>(SOME_NUMBER_U16, 400), true);
+    test_equals(transaction.Set(SOME_STRING, "TRANSACTION"), true);
+    test_equals(transaction.Set(SOME_BOOL, DB::Get<bool>(SOME_BOOL)), true);
+    // out of range values are not staged
+    test_equals(transaction.Set<int16_t>(SOME_NUMBER_16, 200), false);
+
+    // nothing is applied before commit
+    test_unequals(DB::Get<uint16_t>(SOME_NUMBER_U16), uint16_t(400));
+
+    auto changed = transaction.Commit();
+    test_equals(changed.count(), size_t(2));
+    test_equals(changed.test(SOME_NUMBER_U16), true);
+    test_equals(changed.test(SOME_STRING), true);
+    test_equals(changed.test(SOME_BOOL), false);
+    test_equals(DB::Get<uint16_t>(SOME_NUMBER_U16), uint16_t(400));
+    test_equals(DB::GetString<SOME_STRING>().c_str(), "TRANSACTION");
+
+    cout << "TEST PASSED" << endl;
+}
+
+void snapshot_test()
+{
+    DB::Set<uint16_t>(SOME_NUMBER_U16, 200);
+    DB::Set(SOME_STRING, "SNAPSHOT");
+    auto snapshot = DB::Snapshot();
+
+    // later changes don't affect the snapshot
+    DB::Set<uint16_t>(SOME_NUMBER_U16, 300);
+    DB::Set(SOME_STRING, "CHANGED");
+
+    test_equals(snapshot.Get<uint16_t>(SOME_NUMBER_U16), uint16_t(200));
+    test_equals(snapshot.GetString<SOME_STRING>().c_str(), "SNAPSHOT");
+    test_equals(snapshot.Get<const char *>(SOME_STRING), "SNAPSHOT");
+    test_equals(snapshot.Get<Bl>(SOME_BLOB), DB::Get<Bl>(SOME_BLOB));
+
+    Visitor visitor;
+    snapshot.VisitEach(visitor);
+
+    cout << "TEST PASSED" << endl;
+}
+
+void subscription_test()
+{
+    static CountingObserver bool_observer;
+    DB::KeySet keys;
+    keys.set(SOME_BOOL);
+    DB::SetObserver(&bool_observer, keys);
+
+    DB::Set(SOME_NUMBER_U16, uint16_t(123));
+#if SHOOBY_ASYNC_OBSERVERS
+    DB::FlushObservers();
+#endif
+    test_equals(bool_observer.calls, 0);
+
+    DB::Set(SOME_BOOL, not DB::Get<bool>(SOME_BOOL));
+#if SHOOBY_ASYNC_OBSERVERS
+    DB::FlushObservers();
+#endif
+    test_equals(bool_observer.calls, 1);
+
+    cout << "TEST PASSED" << endl;
+}
+
+#if SHOOBY_ASYNC_OBSERVERS
+class ThreadObserver final : public DB::IObserver
+{
+public:
+    void OnSet(Dooby::enum_type type, bool changed) override { thread = std::this_thread::get_id(); }
+    std::thread::id thread{};
+};
+
+void async_observer_test()
+{
+    static ThreadObserver observer;
+    DB::SetObserver(&observer);
+
+    DB::Set(SOME_NUMBER_U16, uint16_t(321));
+    DB::FlushObservers();
+    test_equals(observer.thread != std::thread::id{} && observer.thread != std::this_thread::get_id(), true);
+
+    auto stats = DB::GetNotifierStats();
+    test_equals(stats.queue_depth, size_t(0));
+    test_equals(stats.delivered + stats.dropped + stats.coalesced > 0, true);
+
+    // without the notifier thread FlushObservers delivers on the calling thread instead of blocking
+    auto shard = std::make_unique<Shooby::DBInstance<Dooby>>();
+    shard->Init();
+    ThreadObserver late;
+    shard->SetObserver(&late);
+    shard->Shutdown();
+    test_equals(shard->Set(SOME_NUMBER_U16, uint16_t(456)), true);
+    shard->FlushObservers();
+    test_equals(late.thread == std::this_thread::get_id(), true);
+
+    cout << "TEST PASSED" << endl;
+}
+#endif
+
+void changed_since_test()
+{
+    uint32_t epoch = DB::CurrentEpoch();
+
+    int visited = 0;
+    auto visitor = [&visited](Dooby::enum_type e, const Shooby::value_variant_t &)
+    {
+        test_equals(e, SOME_NUMBER_32);
+        visited++;
+    };
+
+    DB::Set(SOME_NUMBER_32, DB::Get<uint32_t>(SOME_NUMBER_32) + 1);
+    DB::Set(SOME_BOOL, DB::Get<bool>(SOME_BOOL)); // not a change
+
+    uint32_t next = DB::ChangedSince(epoch, visitor);
+    test_equals(visited, 1);
+    test_equals(next, DB::CurrentEpoch());
+
+    DB::ChangedSince(next, visitor);
+    test_equals(visited, 1);
+
+    cout << "TEST PASSED" << endl;
+}
+
+void delta_test()
+{
+    int16_t number = DB::Get<int16_t>(SOME_NUMBER_16);
+    string str = DB::Get<const char *>(SOME_STRING);
+
+    uint8_t delta[DB::MaxDeltaSize()];
+    size_t size = DB::ExportDelta(delta);
+    test_equals(size > 0, true);
+
+    DB::Set(SOME_STRING, "delta");
+    DB::Set(SOME_NUMBER_16, int16_t(42));
+
+    test_equals(DB::ImportDelta(std::span<const uint8_t>(delta, size - 1)), false);
+    test_equals(DB::Get<int16_t>(SOME_NUMBER_16), int16_t(42));
+
+    test_equals(DB::ImportDelta(std::span<const uint8_t>(delta, size)), true);
+    test_equals(DB::Get<int16_t>(SOME_NUMBER_16), number);
+    test_equals(string(DB::Get<const char *>(SOME_STRING)), str);
+
+    // only the chosen keys are exported
+    DB::KeySet keys;
+    keys.set(SOME_BOOL);
+    test_equals(DB::ExportDelta(delta, keys) < size, true);
+
+    cout << "TEST PASSED" << endl;
+}
+
+void lease_test()
+{
+    // the lease holds the entry lock, DB calls on the same key go before or after it
+    Bl copy = DB::Get<Bl>(SOME_BLOB);
+    const Bl *in_buffer = DB::Get<const Bl *>(SOME_BLOB);
+    {
+        auto blob = DB::Read<Bl>(SOME_BLOB);
+        test_equals(bool(blob), true);
+        test_equals(*blob, copy);
+        test_equals(&*blob, in_buffer);
+    }
+
+    size_t length = strlen(DB::Get<const char *>(SOME_STRING));
+    {
+        auto str = DB::Read<std::string_view>(SOME_STRING);
+        test_equals(str->size(), length);
+    }
+
+    Bl blob = DB::Get<Bl>(SOME_BLOB);
+    {
+        auto lease = DB::Write<Bl>(SOME_BLOB);
+        lease->hi++;
+    }
+    blob.hi++;
+    test_equals(DB::Get<Bl>(SOME_BLOB), blob);
+
+#if SHOOBY_SEQLOCK_READS
+    // lock free readers don't wait for the lease, they see the old value until it is released
+    {
+        auto lease = DB::Write<Bl>(SOME_BLOB);
+        lease->hi++;
+        test_equals(DB::Get<Bl>(SOME_BLOB), blob);
+    }
+    blob.hi++;
+    test_equals(DB::Get<Bl>(SOME_BLOB), blob);
+#endif
+
+#ifdef NDEBUG
+    // a type mismatch gives an empty lease that touches nothing
+    uint16_t small = DB::Get<uint16_t>(SOME_NUMBER_U16);
+    {
+        auto lease = DB::Write<uint32_t>(SOME_NUMBER_U16);
+        test_equals(bool(lease), false);
+        test_equals(bool(DB::Read<int32_t>(SOME_NUMBER_U16)), false);
+    }
+    test_equals(DB::Get<uint16_t>(SOME_NUMBER_U16), small);
+#endif
+
+    // out of range values are reverted on release
+    int16_t number = DB::Get<int16_t>(SOME_NUMBER_16);
+    {
+        auto lease = DB::Write<int16_t>(SOME_NUMBER_16);
+        *lease = 1000;
+    }
+    test_equals(DB::Get<int16_t>(SOME_NUMBER_16), number);
+
+    cout << "TEST PASSED" << endl;
+}
+
+// true if DB::Set<K>(V) compiles
+template <Dooby::enum_type K, class V>
+concept typed_set_compiles = requires(V v) { DB::Set<K>(v); };
+
+void typed_test()
+{
+    DB::Set<SOME_NUMBER_U16>(uint16_t(200));
+    test_equals(DB::Get<SOME_NUMBER_U16>(), uint16_t(200));
+    test_equals(DB::Set<SOME_NUMBER_U16>(uint16_t(600)), false); // out of range
+
+    // no implicit conversions: narrowing, float to int and int to bool don't compile
+    static_assert(not typed_set_compiles<SOME_NUMBER_U16, int>);
+    static_assert(not typed_set_compiles<SOME_NUMBER_U16, double>);
+    static_assert(not typed_set_compiles<SOME_BOOL, int>);
+    static_assert(typed_set_compiles<SOME_STRING, std::string_view>);
+
+    DB::Set<SOME_STRING>("TYPED");
+    test_equals(DB::Get<SOME_STRING>().view(), std::string_view("TYPED"));
+
+    Bl blob{.hi = 1};
+    DB::Set<SOME_BLOB>(blob);
+    test_equals(DB::Get<SOME_BLOB>(), blob);
+    static_assert(std::is_same_v<decltype(DB::Get<SOME_FLOAT>()), float>);
+
+    cout << "TEST PASSED" << endl;
+}
+
+// true if FetchAdd compiles with T deduced from the delta
+template <class V>
+concept fetch_add_deduces = requires(V v) { DB::FetchAdd(SOME_NUMBER_U16, v); };
+
+void update_test()
+{
+    DB::Set(SOME_NUMBER_U16, uint16_t(100));
+    test_equals(DB::Update<uint16_t>(SOME_NUMBER_U16, [](uint16_t &value)
+                                     { value += 5; }),
+                true);
+    test_equals(DB::Get<uint16_t>(SOME_NUMBER_U16), uint16_t(105));
+
+    // out of range results are dropped
+    test_equals(DB::Update<uint16_t>(SOME_NUMBER_U16, [](uint16_t &value)
+                                     { value = 600; }),
+                false);
+    test_equals(DB::Get<uint16_t>(SOME_NUMBER_U16), uint16_t(105));
+
+    Bl blob = DB::Get<Bl>(SOME_BLOB);
+    DB::Update<Bl>(SOME_BLOB, [](Bl &value)
+                   { value.a++; });
+    blob.a++;
+    test_equals(DB::Get<Bl>(SOME_BLOB), blob);
+
+    uint16_t expected = 100;
+    test_equals(DB::CompareExchange(SOME_NUMBER_U16, expected, uint16_t(200)), false);
+    test_equals(expected, uint16_t(105));
+    test_equals(DB::CompareExchange(SOME_NUMBER_U16, expected, uint16_t(200)), true);
+    test_equals(DB::Get<uint16_t>(SOME_NUMBER_U16), uint16_t(200));
+    test_equals(DB::CompareExchange(SOME_NUMBER_U16, expected, uint16_t(600)), false);
+
+    // saturates at the MetaData min/max
+    DB::Set(SOME_NUMBER_16, int16_t(90));
+    test_equals(DB::FetchAdd<int16_t>(SOME_NUMBER_16, 5), int16_t(90));
+    test_equals(DB::FetchAdd<int16_t>(SOME_NUMBER_16, 20), int16_t(95));
+    test_equals(DB::Get<int16_t>(SOME_NUMBER_16), int16_t(100));
+    test_equals(DB::FetchSub<int16_t>(SOME_NUMBER_16, 1000), int16_t(100));
+    test_equals(DB::Get<int16_t>(SOME_NUMBER_16), int16_t(-50));
+
+    DB::Set(SOME_NUMBER_U16, uint16_t(3));
+    DB::FetchSub<uint16_t>(SOME_NUMBER_U16, 5);
+    test_equals(DB::Get<uint16_t>(SOME_NUMBER_U16), uint16_t(0));
+
+    // an int literal delta converts to the entry type, it never picks T
+    static_assert(not fetch_add_deduces<int>);
+    Bl blob_after = DB::Get<Bl>(SOME_BLOB);
+    DB::Set(SOME_NUMBER_U16, uint16_t(499));
+    test_equals(DB::FetchAdd<uint16_t>(SOME_NUMBER_U16, 1), uint16_t(499));
+    test_equals(DB::FetchAdd<uint16_t>(SOME_NUMBER_U16, 1), uint16_t(500));
+    test_equals(DB::Get<uint16_t>(SOME_NUMBER_U16), uint16_t(500));
+    test_equals(DB::Get<int16_t>(SOME_NUMBER_16), int16_t(-50));
+    test_equals(DB::Get<Bl>(SOME_BLOB), blob_after);
+
+    DB::Set(SOME_FLOAT, 1.5f);
+    test_equals(DB::FetchAdd<float>(SOME_FLOAT, 0.25f), 1.5f);
+    test_equals(DB::Get<float>(SOME_FLOAT), 1.75f);
+
+    cout << "TEST PASSED" << endl;
+}
+
+#if SHOOBY_ATOMIC_ARITHMETIC
+void atomic_test()
+{
+    // a shard without observers, so the writer doesn't print
+    auto shard = std::make_unique<Shooby::DBInstance<Dooby>>();
+    shard->Init();
+
+    // a writer keeps flipping the value while a reader loads it without the lock
+    std::atomic<bool> stop{false};
+    std::thread writer([&shard, &stop]
+                       {
+                           for (uint32_t i = 0; not stop.load(); i++)
+                               shard->Set(SOME_NUMBER_32, (i & 1) ? uint32_t(0xFFFFFFFF) : uint32_t(0)); });
+
+    for (int i = 0; i < 100000; i++)
+    {
+        uint32_t number = shard->Get<uint32_t>(SOME_NUMBER_32);
+        if (number != 0 && number != 0xFFFFFFFF && number != 32)
+            test_equals(number, uint32_t(0));
+    }
+
+    stop = true;
+    writer.join();
+
+    shard->Set(SOME_NUMBER_32, uint32_t(5));
+    test_equals(shard->Set(SOME_NUMBER_32, uint32_t(5)), false);
+    {
+        auto lease = shard->Write<uint32_t>(SOME_NUMBER_32);
+        *lease = 7;
+    }
+    test_equals(shard->Get<uint32_t>(SOME_NUMBER_32), uint32_t(7));
+
+    cout << "TEST PASSED" << endl;
+}
+#endif
+
+void instance_test()
+{
+    // shards of the same META_MAP share nothing with each other or with DB
+    using Shard = Shooby::DBInstance<Dooby>;
+    auto a = std::make_unique<Shard>();
+    auto b = std::make_unique<Shard>();
+    a->Init();
+    b->Init();
+
+    uint32_t number = DB::Get<uint32_t>(SOME_NUMBER_32);
+    test_equals(a->Set(SOME_NUMBER_32, uint32_t(1)), true);
+    test_equals(b->Get<uint32_t>(SOME_NUMBER_32), uint32_t(32));
+    test_equals(DB::Get<uint32_t>(SOME_NUMBER_32), number);
+
+    // one observer can watch several shards, with other keys in each
+    CountingObserver observer;
+    DB::KeySet keys;
+    keys.set(SOME_BOOL);
+    a->SetObserver(&observer);
+    b->SetObserver(&observer, keys);
+
+    Shard::Transaction transaction(*b);
+    transaction.Set(SOME_NUMBER_32, uint32_t(2));
+    transaction.Set(SOME_BOOL, false);
+    test_equals(transaction.Commit().count(), size_t(2));
+    b->Set(SOME_NUMBER_32, uint32_t(3));
+#if SHOOBY_ASYNC_OBSERVERS
+    b->FlushObservers();
+#endif
+    test_equals(observer.calls, 1);
+    test_equals(a->Get<uint32_t>(SOME_NUMBER_32), uint32_t(1));
+    test_equals(b->Get<SOME_NUMBER_32>(), uint32_t(3));
+
+    // registrations past SHOOBY_MAX_OBSERVERS are refused
+    auto full = std::make_unique<Shard>();
+    full->Init();
+    CountingObserver observers[SHOOBY_MAX_OBSERVERS + 1];
+    for (size_t i = 0; i < SHOOBY_MAX_OBSERVERS; i++)
+        test_equals(full->SetObserver(&observers[i]), true);
+
+    test_equals(full->SetObserver(&observers[SHOOBY_MAX_OBSERVERS]), false);
+    full->Set(SOME_BOOL, false);
+#if SHOOBY_ASYNC_OBSERVERS
+    full->FlushObservers();
+#endif
+    test_equals(observers[0].calls, 1);
+    test_equals(observers[SHOOBY_MAX_OBSERVERS].calls, 0);
+
+    cout << "TEST PASSED" << endl;
+}
+
+#if SHOOBY_STATS
+void stats_test()
+{
+    DB::ResetStats();
+    uint32_t number = DB::Get<uint32_t>(SOME_NUMBER_32);
+    DB::Set(SOME_NUMBER_32, number + 1);
+    DB::Set(SOME_NUMBER_32, number + 1);
+
+    int visited = 0;
+    auto visitor = [&visited](Dooby::enum_type e, const Shooby::MetaData &meta, const DB::EntryStats &stats)
+    {
+        visited++;
+        if (e != SOME_NUMBER_32)
+            return;
+
+        test_equals(stats.gets, uint64_t(1));
+        test_equals(stats.sets, uint64_t(2));
+        test_equals(stats.changed, uint64_t(1));
+        // the unchanged Set of an atomic entry returns before locking
+        uint64_t locked_sets = SHOOBY_ATOMIC_ARITHMETIC ? 1 : 2;
+        test_equals(stats.lock_wait.count, locked_sets);
+        test_equals(stats.set_if_changed.count, locked_sets);
+    };
+
+    DB::VisitStats(visitor);
+    test_equals(visited, int(Dooby::NUM));
+
+    cout << "TEST PASSED" << endl;
+}
+#endif
+
+#if SHOOBY_WRITE_BEHIND
+void write_behind_test()
+{
+    CountingBackend backend;
+    {
+        auto shard = std::make_unique<Shooby::DBInstance<Dooby>>();
+        shard->Init(&backend);
+
+        // the flusher waits SHOOBY_WRITE_BEHIND_PERIOD_MS after the first dirty entry, these writes pile up
+        shard->Set(SOME_NUMBER_32, uint32_t(1));
+        shard->Set(SOME_NUMBER_32, uint32_t(2));
+        shard->Set(SOME_NUMBER_32, uint32_t(3));
+        shard->Set(SOME_BOOL, false);
+        test_equals(backend.saves, 0);
+
+        // a durability point, everything dirty is saved when it returns
+        shard->Flush();
+        auto stats = shard->GetWriteBehindStats();
+        test_equals(stats.queue_depth, size_t(0));
+        test_equals(stats.saved_entries, size_t(2));
+        test_equals(stats.coalesced_writes, size_t(2));
+        test_equals(backend.batch.size(), size_t(2));
+
+        // destroyed without Shutdown, the dirty entry is still saved
+        shard->Set(SOME_NUMBER_32, uint32_t(4));
+    }
+
+    test_equals(backend.batch.size(), size_t(1));
+    test_equals(backend.batch[0], std::string("SOME_NUMBER_32"));
+
+    cout << "TEST PASSED" << endl;
+}
+#endif
+
+#if SHOOBY_DEFERRED_PERSIST
+void deferred_test()
+{
+    CountingBackend backend;
+    auto shard = std::make_unique<Shooby::DBInstance<Dooby>>();
+    shard->Init(&backend);
+    int loaded_batches = backend.batches;
+
+    // changed Sets only mark their keys dirty, nothing reaches the backend
+    shard->Set(SOME_NUMBER_32, uint32_t(1));
+    shard->Set(SOME_NUMBER_32, uint32_t(2));
+    shard->Set(SOME_NUMBER_U16, uint16_t(17));
+    test_equals(backend.saves, 0);
+#if SHOOBY_DEFERRED_AUTO_FLUSH == 0 || SHOOBY_DEFERRED_AUTO_FLUSH > 2
+    test_equals(backend.batches, loaded_batches);
+    test_equals(shard->IsDirty(SOME_NUMBER_32), true);
+    test_equals(shard->IsDirty(SOME_BOOL), false);
+    test_equals(shard->DirtyCount(), size_t(2));
+
+    // one batch with every dirty key, in offset order
+    shard->Flush();
+#endif
+#if SHOOBY_DEFERRED_AUTO_FLUSH != 1
+    test_equals(backend.saves, 0);
+    test_equals(backend.batches, loaded_batches + 1);
+    test_equals(backend.batch == std::vector<std::string>{"SOME_NUMBER_U16", "SOME_NUMBER_32"}, true);
+    test_equals(shard->DirtyCount(), size_t(0));
+
+    // nothing dirty, nothing saved
+    shard->Flush();
+    test_equals(backend.batches, loaded_batches + 1);
+#else
+    // every changed Set flushes its own key
+    test_equals(backend.batches, loaded_batches + 3);
+    test_equals(backend.batch == std::vector<std::string>{"SOME_NUMBER_U16"}, true);
+#endif
+
+    cout << "TEST PASSED" << endl;
+}
+#endif
+
+#if SHOOBY_LOCK_PROFILING
+void lock_profile_test()
+{
+    DB::ResetLockProfile();
+    uint32_t number = DB::Get<uint32_t>(SOME_NUMBER_32);
+    DB::Set(SOME_NUMBER_32, number + 1);
+    DB::Set(SOME_NUMBER_32, number + 1);
+
+    bool set_seen = false;
+    uint64_t last_max_hold = UINT64_MAX;
+    auto visitor = [&](const DB::LockSiteProfile &profile)
+    {
+        test_equals(profile.counts.max_hold_ns <= last_max_hold, true);
+        last_max_hold = profile.counts.max_hold_ns;
+
+        if (strcmp(profile.site, "Set") == 0)
+        {
+            set_seen = true;
+            test_equals(profile.counts.acquisitions, uint64_t(SHOOBY_ATOMIC_ARITHMETIC ? 1 : 2));
+            test_equals(profile.max_hold_key, "SOME_NUMBER_32");
+        }
+    };
+
+    DB::VisitLockProfile(visitor);
+    test_equals(set_seen, true);
+
+    cout << "TEST PASSED" << endl;
+}
+#endif
+
+void reset_test()
+{
+    DB::Reset();
+    test_equals(DB::Get<uint16_t>(SOME_NUMBER_U16), uint16_t(16));
+    test_equals(DB::Get<bool>(SOME_BOOL), true);
+    test_equals(DB::GetString<SOME_STRING>().c_str(), "WHATEVER");
+    test_equals(DB::Get<Bl>(SOME_BLOB), Bl{});
+
+    cout << "TEST PASSED" << endl;
+}
+
+#if SHOOBY_MMAP_BUFFER
+// overwrites 4 bytes of the mapped image header at offset
+void patch_header(const std::string &path, long offset, uint32_t value)
+{
+    FILE *f = fopen(path.c_str(), "r+b");
+    fseek(f, offset, SEEK_SET);
+    fwrite(&value, sizeof(value), 1, f);
+    fclose(f);
+}
+
+void mapped_test()
+{
+    using Shard = Shooby::DBInstance<Dooby>;
+    std::string path = (std::filesystem::temp_directory_path() / "shooby_mapped_test.bin").string();
+    std::filesystem::remove(path);
+
+    // a new file gets the defaults
+    {
+        auto shard = std::make_unique<Shard>();
+        test_equals(shard->InitMapped(path.c_str()), false);
+        test_equals(shard->Get<uint32_t>(SOME_NUMBER_32), uint32_t(32));
+        shard->Set(SOME_NUMBER_32, uint32_t(77));
+        shard->Set(SOME_STRING, "MAPPED");
+    }
+
+    // a valid image survives reopen
+    {
+        auto shard = std::make_unique<Shard>();
+        test_equals(shard->InitMapped(path.c_str()), true);
+        test_equals(shard->Get<uint32_t>(SOME_NUMBER_32), uint32_t(77));
+        test_equals(shard->GetString<SOME_STRING>().c_str(), "MAPPED");
+    }
+
+    // header layout: [magic][version][fingerprint][data size]
+    // a bad magic loads the defaults and restamps the file
+    patch_header(path, 0, 0xBAD);
+    {
+        auto shard = std::make_unique<Shard>();
+        test_equals(shard->InitMapped(path.c_str()), false);
+        test_equals(shard->Get<uint32_t>(SOME_NUMBER_32), uint32_t(32));
+        shard->Set(SOME_NUMBER_32, uint32_t(78));
+    }
+
+    // an image of another META_MAP layout falls back to the defaults
+    patch_header(path, 8, 0xBAD);
+    {
+        auto shard = std::make_unique<Shard>();
+        test_equals(shard->InitMapped(path.c_str()), false);
+        test_equals(shard->Get<uint32_t>(SOME_NUMBER_32), uint32_t(32));
+        test_equals(shard->GetString<SOME_STRING>().c_str(), "WHATEVER");
+    }
+
+    std::filesystem::remove(path);
+    cout << "TEST PASSED" << endl;
+}
+#endif
+
+void log_backend_test()
+{
+    using Shard = Shooby::DBInstance<Dooby>;
+    std::string path = (std::filesystem::temp_directory_path() / "shooby_log_test.log").string();
+    std::filesystem::remove(path);
+
+    // the backend outlives the shards using it
+    Shooby::LogBackend backend(path.c_str(), 1 << 20, false);
+    {
+        auto shard = std::make_unique<Shard>();
+        shard->Init(&backend);
+        for (uint32_t i = 1; i <= 100; i++)
+            shard->Set(SOME_NUMBER_32, i);
+        shard->Set(SOME_STRING, "LOGGED");
+#if SHOOBY_WRITE_BEHIND || SHOOBY_DEFERRED_PERSIST
+        shard->Flush();
+#endif
+
+        // only the latest record of every key is kept
+        size_t before = backend.LogSize();
+        backend.Compact();
+        test_equals(backend.LogSize() < before, true);
+        test_equals(backend.LogSize(), size_t(std::filesystem::file_size(path)));
+    }
+
+    // replayed after reopen
+    {
+        auto shard = std::make_unique<Shard>();
+        shard->Init(&backend);
+        test_equals(shard->Get<uint32_t>(SOME_NUMBER_32), uint32_t(100));
+        test_equals(shard->GetString<SOME_STRING>().c_str(), "LOGGED");
+    }
+
+    // a record torn by a crash is dropped, the records before it are kept
+    size_t intact = std::filesystem::file_size(path);
+    {
+        FILE *f = fopen(path.c_str(), "ab");
+        const uint8_t torn[] = {14, 0, 0, 0, 4, 0, 0, 0, 'S', 'O', 'M', 'E'};
+        fwrite(torn, sizeof(torn), 1, f);
+        fclose(f);
+    }
+
+    {
+        auto shard = std::make_unique<Shard>();
+        shard->Init(&backend);
+        test_equals(shard->Get<uint32_t>(SOME_NUMBER_32), uint32_t(100));
+        test_equals(size_t(std::filesystem::file_size(path)), intact);
+    }
+
+    std::filesystem::remove(path);
+    cout << "TEST PASSED" << endl;
+}
+
+// runs last, Init switches the DB to a new backend
+void image_test()
+{
+    static ImageBackend backend;
+    DB::Init(&backend);
+    test_equals(backend.image_saves, 1);
+
+    DB::Set(SOME_NUMBER_32, uint32_t(0xC0FFEE));
+#if SHOOBY_WRITE_BEHIND || SHOOBY_DEFERRED_PERSIST
+    DB::Flush();
+#endif
+    test_equals(backend.image_saves, 2);
+
+    // matching fingerprint, loaded from the image
+    DB::Init(&backend);
+    test_equals(DB::Get<uint32_t>(SOME_NUMBER_32), uint32_t(0xC0FFEE));
+    test_equals(backend.image_saves, 2);
+
+    // layout mismatch, loaded by name and the image is rewritten
+    backend.fingerprint++;
+    DB::Init(&backend);
+    test_equals(DB::Get<uint32_t>(SOME_NUMBER_32), uint32_t(32));
+    test_equals(backend.image_saves, 3);
+
+    // a failed region write drops the image, the next Init doesn't roll back to it
+    DB::Set(SOME_NUMBER_32, uint32_t(0xC0FFEE));
+#if SHOOBY_WRITE_BEHIND || SHOOBY_DEFERRED_PERSIST
+    DB::Flush();
+#endif
+    backend.fail_saves = true;
+    DB::Set(SOME_NUMBER_32, uint32_t(0xBEEF));
+#if SHOOBY_WRITE_BEHIND || SHOOBY_DEFERRED_PERSIST
+    DB::Flush();
+#endif
+    test_equals(backend.image.empty(), true);
+
+    backend.fail_saves = false;
+    DB::Init(&backend);
+    test_equals(DB::Get<uint32_t>(SOME_NUMBER_32) != uint32_t(0xC0FFEE), true);
+    test_equals(backend.image_saves, 5);
+
+    cout << "TEST PASSED" << endl;
+}
+
 int main(void)
 {
 
@@ -267,6 +1045,39 @@ int main(void)
         test_number();
         test_bool();
         range_tests();
+        transaction_test();
+        snapshot_test();
+        subscription_test();
+#if SHOOBY_ASYNC_OBSERVERS
+        async_observer_test();
+#endif
+        changed_since_test();
+        delta_test();
+        lease_test();
+        typed_test();
+        update_test();
+#if SHOOBY_ATOMIC_ARITHMETIC
+        atomic_test();
+#endif
+        instance_test();
+#if SHOOBY_STATS
+        stats_test();
+#endif
+#if SHOOBY_WRITE_BEHIND
+        write_behind_test();
+#endif
+#if SHOOBY_DEFERRED_PERSIST
+        deferred_test();
+#endif
+#if SHOOBY_LOCK_PROFILING
+        lock_profile_test();
+#endif
+        reset_test();
+#if SHOOBY_MMAP_BUFFER
+        mapped_test();
+#endif
+        log_backend_test();
+        image_test();
     }
     catch (const char *e)
     {
@@ -274,6 +1085,10 @@ int main(void)
         return 1;
     }
 
+#if SHOOBY_WRITE_BEHIND || SHOOBY_ASYNC_OBSERVERS
+    DB::Shutdown();
+#endif
+
     cout << "TEST PASSED" << endl;
 
     return 0;
@@ -27,6 +27,144 @@
 #if !defined(SHOOBY_MUTEX_INIT) || !defined(SHOOBY_LOCK) || !defined(SHOOBY_UNLOCK)
 #error "SHOOBY_MUTEX_TYPE is defined but SHOOBY_MUTEX_INIT or SHOOBY_LOCK/UNLOCK is not defined"
 #endif
+#ifndef SHOOBY_SHARED_MUTEX_TYPE
+// a custom mutex without a shared one: read paths lock it exclusively
+#define SHOOBY_SHARED_MUTEX_TYPE SHOOBY_MUTEX_TYPE
+#define SHOOBY_SHARED_MUTEX_INIT(m) SHOOBY_MUTEX_INIT(m)
+#define SHOOBY_LOCK_SHARED(m) SHOOBY_LOCK(m)
+#define SHOOBY_UNLOCK_SHARED(m) SHOOBY_UNLOCK(m)
+#define SHOOBY_LOCK_EXCLUSIVE(m) SHOOBY_LOCK(m)
+#define SHOOBY_UNLOCK_EXCLUSIVE(m) SHOOBY_UNLOCK(m)
+#endif
+#endif
+
+// SHARED MUTEX RELATED IMPLEMENTATION
+// The DB entries are guarded by a reader-writer mutex: read only paths (Get, GetString, Visit, VisitRaw,
+// Snapshot, Read leases...) lock it with SHOOBY_LOCK_SHARED so they run in parallel, writes lock it with
+// SHOOBY_LOCK_EXCLUSIVE/SHOOBY_UNLOCK_EXCLUSIVE. A custom SHOOBY_SHARED_MUTEX_TYPE must define all of its hooks.
+#ifndef SHOOBY_SHARED_MUTEX_TYPE
+#include <shared_mutex>
+#define SHOOBY_SHARED_MUTEX_TYPE std::shared_mutex
+#define SHOOBY_SHARED_MUTEX_INIT(m)
+#define SHOOBY_LOCK_SHARED(m) m.lock_shared()
+#define SHOOBY_UNLOCK_SHARED(m) m.unlock_shared()
+#define SHOOBY_LOCK_EXCLUSIVE(m) m.lock()
+#define SHOOBY_UNLOCK_EXCLUSIVE(m) m.unlock()
+#else
+#if !defined(SHOOBY_SHARED_MUTEX_INIT) || !defined(SHOOBY_LOCK_SHARED) || !defined(SHOOBY_UNLOCK_SHARED) || \
+    !defined(SHOOBY_LOCK_EXCLUSIVE) || !defined(SHOOBY_UNLOCK_EXCLUSIVE)
+#error "SHOOBY_SHARED_MUTEX_TYPE is defined but SHOOBY_SHARED_MUTEX_INIT, SHOOBY_LOCK_SHARED/UNLOCK_SHARED or SHOOBY_LOCK_EXCLUSIVE/UNLOCK_EXCLUSIVE is not defined"
+#endif
+#endif
+
+// OBSERVERS
+// Maximum number of observers per DB (up to 64). Every DB keeps a bitmask of subscribed observers per entry
+#ifndef SHOOBY_MAX_OBSERVERS
+#define SHOOBY_MAX_OBSERVERS 32
+#endif
+
+// ASYNCHRONOUS OBSERVERS
+// When set to 1, Set/Commit/Reset only push (key, changed) events into a bounded lock free queue of
+// SHOOBY_ASYNC_QUEUE_SIZE events (power of 2) and a notifier thread calls the observers, so a slow
+// observer never delays a writer. Observers get OnSet per key in this mode, never OnSetMany.
+// SHOOBY_ASYNC_OVERFLOW decides what happens when the queue is full:
+// SHOOBY_ASYNC_OVERFLOW_COALESCE keeps one pending notification per key, delivered after the queue drains.
+// SHOOBY_ASYNC_OVERFLOW_DROP_OLDEST discards the oldest queued event to make room.
+// Use DB::FlushObservers() to wait for delivery and DB::Shutdown() before exit.
+#ifndef SHOOBY_ASYNC_OBSERVERS
+#define SHOOBY_ASYNC_OBSERVERS 0
+#endif
+
+#ifndef SHOOBY_ASYNC_QUEUE_SIZE
+#define SHOOBY_ASYNC_QUEUE_SIZE 64
+#endif
+
+#define SHOOBY_ASYNC_OVERFLOW_COALESCE 0
+#define SHOOBY_ASYNC_OVERFLOW_DROP_OLDEST 1
+#ifndef SHOOBY_ASYNC_OVERFLOW
+#define SHOOBY_ASYNC_OVERFLOW SHOOBY_ASYNC_OVERFLOW_COALESCE
+#endif
+
+// LOCK STRIPES
+// Number of mutexes the DB entries are spread on by index (entry i uses stripe i % SHOOBY_LOCK_STRIPES).
+// 1 means a single DB wide mutex. Values bigger than the number of entries give a mutex per entry.
+// Whole DB operations (Init, Reset, VisitEach...) lock all stripes in index order.
+#ifndef SHOOBY_LOCK_STRIPES
+#define SHOOBY_LOCK_STRIPES 1
+#endif
+
+// LOCK FREE READS
+// When set to 1, Get/GetString/Visit copy values out of the DB under a sequence counter
+// and retry on a torn read instead of taking the mutex. Writers still serialize on the mutex.
+#ifndef SHOOBY_SEQLOCK_READS
+#define SHOOBY_SEQLOCK_READS 0
+#endif
+
+// WRITE BEHIND PERSISTENCE
+// When set to 1, Set only marks changed entries dirty and a background flusher thread saves them,
+// so a slow IBackend::Save never runs under the DB lock. Writes to the same key between two flushes
+// are coalesced into one save. The flusher waits SHOOBY_WRITE_BEHIND_PERIOD_MS after the first dirty
+// entry before flushing. Use DB::Flush() as a durability point and DB::Shutdown() before exit.
+// A DB destroyed without Shutdown still saves its dirty entries, so its backend must outlive it.
+#ifndef SHOOBY_WRITE_BEHIND
+#define SHOOBY_WRITE_BEHIND 0
+#endif
+
+#ifndef SHOOBY_WRITE_BEHIND_PERIOD_MS
+#define SHOOBY_WRITE_BEHIND_PERIOD_MS 100
+#endif
+
+// DEFERRED PERSISTENCE
+// When set to 1, Set only flips the bit of a changed entry in a dirty bitmap and nothing is saved until
+// DB::Flush(), which hands every dirty entry to the backend in one IBackend::SaveBatch, in offset order.
+// No thread is involved. SHOOBY_DEFERRED_AUTO_FLUSH > 0 flushes from the writer once that many keys are
+// dirty, 0 leaves flushing to the application. Can't be combined with SHOOBY_WRITE_BEHIND.
+#ifndef SHOOBY_DEFERRED_PERSIST
+#define SHOOBY_DEFERRED_PERSIST 0
+#endif
+
+#ifndef SHOOBY_DEFERRED_AUTO_FLUSH
+#define SHOOBY_DEFERRED_AUTO_FLUSH 0
+#endif
+
+#if SHOOBY_DEFERRED_PERSIST && SHOOBY_WRITE_BEHIND
+#error "SHOOBY_DEFERRED_PERSIST and SHOOBY_WRITE_BEHIND are mutually exclusive"
+#endif
+
+// ATOMIC ARITHMETIC ENTRIES
+// When set to 1, arithmetic entries (all of them are up to 4 bytes and naturally aligned in the data buffer)
+// are read and written with single atomic loads and stores. Get never locks them and a Set that doesn't
+// change the value returns without locking. A changed value still takes the entry lock to stamp its epoch,
+// persist it and keep whole DB operations consistent. Needs std::atomic_ref to be lock free for 1, 2 and
+// 4 byte words.
+#ifndef SHOOBY_ATOMIC_ARITHMETIC
+#define SHOOBY_ATOMIC_ARITHMETIC 0
+#endif
+
+// MEMORY MAPPED DATA BUFFER (POSIX only)
+// When set to 1, DB::InitMapped(path) places the data buffer inside a memory mapped file instead of
+// loading it from a backend. Startup is one mmap and a header check, changes are persisted by msync
+// of the pages that hold them. If the file layout doesn't match the META_MAP, defaults are loaded.
+#ifndef SHOOBY_MMAP_BUFFER
+#define SHOOBY_MMAP_BUFFER 0
+#endif
+
+// INSTRUMENTATION
+// When set to 1, every DB counts gets, sets and changes per entry and keeps latency histograms per entry
+// for lock wait (Set), set_if_changed, backend save (IBackend::Save or the write behind enqueue of one
+// entry) and observer dispatch (OnSet). Counters are relaxed atomics. Read them with DB::VisitStats.
+// When 0 the instrumentation compiles away.
+#ifndef SHOOBY_STATS
+#define SHOOBY_STATS 0
+#endif
+
+// LOCK PROFILING
+// When set to 1, every lock the DB takes is timestamped on the acquire attempt, the acquire and the release.
+// Wait and hold times are kept per call site (Init, Get, Set, batch, Visit, snapshot, lease, flush, observer
+// registration) with the max hold time and the key that held it. Read them with DB::VisitLockProfile.
+// When 0 the locks are the plain SHOOBY_LOCK_EXCLUSIVE/SHOOBY_LOCK_SHARED guards.
+#ifndef SHOOBY_LOCK_PROFILING
+#define SHOOBY_LOCK_PROFILING 0
 #endif
 
 #endif // __SHOOBY_CONFIG_H__
@@ -2,9 +2,27 @@
 #define _SHOOBY_DB_H_
 
 #include <bit>
+#include <bitset>
+#include <optional>
+#include <span>
 #include "shooby_utilities.h"
 #include "shooby_config.h"
 
+#if SHOOBY_WRITE_BEHIND || SHOOBY_ASYNC_OBSERVERS || SHOOBY_STATS
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+#if SHOOBY_MMAP_BUFFER
+#include "shooby_mmap.h"
+#endif
+
+#if SHOOBY_LOCK_PROFILING
+#include <algorithm>
+#endif
+
 // ================== META DATA CLASS =================
 
 namespace Shooby
@@ -13,6 +31,7 @@ namespace Shooby
     struct MetaData
     {
         consteval MetaData(const char *n, float num_default, float min, float max) : size(sizeof(float)),
+                                                                                     alignment(alignof(float)),
                                                                                      name(n),
                                                                                      default_val(num_default),
                                                                                      arithmetic_min(std::bit_cast<uint32_t>(min)),
@@ -23,20 +42,23 @@ namespace Shooby
 
         template <Arithmetic T>
         consteval MetaData(const char *n, T num_default, T min, T max) : size(sizeof(T)),
+                                                                         alignment(alignof(T)),
                                                                          name(n),
                                                                          default_val(num_default),
                                                                          arithmetic_min(static_cast<uint32_t>(min)),
                                                                          arithmetic_max(static_cast<uint32_t>(max)) {}
 
-        consteval MetaData(const char *n, size_t s, const char *def_str) : size(s), name(n), default_val(def_str) {}
+        // the string length prefix is stored right before the chars and sets their alignment
+        consteval MetaData(const char *n, size_t s, const char *def_str) : size(s), alignment(alignof(string_length_t)), name(n), default_val(def_str) {}
 
         template <class T>
-        consteval MetaData(const char *n, const T *def_blob, size_t s = sizeof(T)) : size(s), name(n), default_val((const void *)def_blob)
+        consteval MetaData(const char *n, const T *def_blob, size_t s = sizeof(T)) : size(s), alignment(alignof(T)), name(n), default_val((const void *)def_blob)
         {
             SHOOBY_ASSERT(sizeof(T) == size, "blob size mismatch");
         }
 
         const size_t size;
+        const size_t alignment = 1; // values are placed in the data buffer at this alignment
         const char *name;
         const value_variant_t default_val;
         const int32_t arithmetic_min = std::numeric_limits<uint32_t>::min();
@@ -45,6 +67,14 @@ namespace Shooby
 
     // ==================== BACKEND INTERFACE ====================
 
+    struct BackendEntry
+    {
+        const char *name;
+        void *data;
+        size_t size;
+        bool found = false; // set by IBackend::LoadAll
+    };
+
     struct IBackend
     {
     public:
@@ -59,47 +89,208 @@ namespace Shooby
         // Load values from the backend.
         // Should return false if the value is not found, true otherwise
         virtual bool Load(const char *e_name, void *data, size_t size) = 0;
+
+        // Save several changed values at once (Init, Reset, a committed transaction).
+        // not mandatory, override if the backend can write a batch cheaper than one value at a time
+        virtual void SaveBatch(std::span<const BackendEntry> entries)
+        {
+            for (const BackendEntry &entry : entries)
+                Save(entry.name, entry.data, entry.size);
+        }
+
+        // Load all values at once, called by DB::Init. not mandatory, override to load in one read.
+        // Should set found for every loaded entry, entries left not found are saved with their default
+        virtual void LoadAll(std::span<BackendEntry> entries)
+        {
+            for (BackendEntry &entry : entries)
+                entry.found = Load(entry.name, entry.data, entry.size);
+        }
+
+        // Load the whole data buffer in one read, called by DB::Init before anything else. not mandatory.
+        // Should return false if there is no image or it was saved with another fingerprint (META_MAP layout)
+        virtual bool LoadImage(uint32_t, void *, size_t) { return false; }
+
+        // Save a region of the data buffer image tagged with fingerprint. DB::Init saves the whole image
+        // (offset 0) after loading by name, then every change saves its region before the values by name,
+        // so a valid image is never older than them and is what DB::Init loads. not mandatory.
+        // Should return false if images are not supported or the write failed, the DB will not call it again
+        virtual bool SaveImage(uint32_t, size_t, const void *, size_t) { return false; }
+
+        // Drop the image so the next LoadImage returns false, called when SaveImage fails.
+        // mandatory for backends that save images: the values by name saved afterwards are newer than it
+        virtual void InvalidateImage() {}
     };
 
     // ================== DATABASE CLASS =================
 
+    /*
+        A database of a META_MAP with its own data buffer, locks, backend and observers.
+        Instances of the same META_MAP share nothing, so per device or per tenant shards scale
+        across cores without sharing a lock. DB<E> below offers the same API over one static instance.
+        Instances are not copyable or movable, a MappedImage or background thread refers to them.
+
+        example usage:
+        DBInstance<CONFIG> shard;
+        shard.Init(&backend);
+        shard.Set(PORT, uint16_t(8883));
+    */
     template <EnumMetaMap E>
-    class DB
+    class DBInstance
     {
     public:
-        static void Init(IBackend *backend = nullptr);
+        using KeySet = std::bitset<E::NUM>;
 
-        static void Reset();
+        DBInstance() = default;
+        ~DBInstance();
 
+        DBInstance(const DBInstance &) = delete;
+        DBInstance &operator=(const DBInstance &) = delete;
+        DBInstance(DBInstance &&) = delete;
+        DBInstance &operator=(DBInstance &&) = delete;
+
+        void Init(IBackend *backend = nullptr);
+
+#if SHOOBY_MMAP_BUFFER
+        // Init with the data buffer inside a memory mapped file at path, instead of a backend.
+        // returns true if the file held a valid image, false if defaults were loaded into it
+        bool InitMapped(const char *path);
+#endif
+
+        // sets all values back to their defaults, changes are saved to the backend in one batch
+        void Reset();
+
+        /*
+        returns a copy of the value.
+        Get<std::string_view> returns a view of a string entry in the internal buffer without copying,
+        like Get<const char *> it can be modified in another thread while used.
+        */
         template <NotPointer T>
-        static T Get(E::enum_type e);
+        T Get(E::enum_type e);
 
         /*
         returns a const pointer to the internal buffer.
         it can still be modified in another thread, so be careful.
 
-        Best practice for strings is to use the GetString() function.
+        Best practice for strings is to use the GetString() function, and Read() to use a value in place.
         */
         template <Pointer T>
-        static T Get(E::enum_type e);
+        T Get(E::enum_type e);
 
         template <E::enum_type e>
-        static FixedString<E::META_MAP[e].size> GetString();
+        FixedString<E::META_MAP[e].size> GetString();
+
+        // value type of a key: the arithmetic type, const char * for strings, the blob type for blobs
+        template <E::enum_type K>
+        using value_t = typename decltype(key_type_tag<E, K>())::type;
+
+        /*
+        Typed access with the type taken from the META_MAP at compile time, no runtime type checks.
+        Get<KEY>() returns the value (a FixedString for strings). Set<KEY>(value) takes exactly the key type,
+        anything convertible to std::string_view for strings, other types fail to compile.
+        It returns false if the value is out of range.
+
+        example usage:
+        uint16_t port = DB<CONFIG>::Get<PORT>();
+        DB<CONFIG>::Set<PORT>(uint16_t(8883));
+        */
+        template <E::enum_type K>
+        auto Get();
+
+        // true if V is accepted by Set<K>: the key type itself, or convertible to std::string_view for strings
+        template <E::enum_type K, class V>
+        static constexpr bool settable_as = std::is_same_v<value_t<K>, const char *> ? std::is_convertible_v<const V &, std::string_view>
+                                                                                      : std::is_same_v<V, value_t<K>>;
+
+        template <E::enum_type K, class V>
+        bool Set(const V &v)
+            requires settable_as<K, V>;
+
+        // strings can be set from a const char * or a std::string_view (without NUL characters inside)
+        template <class T>
+        bool Set(E::enum_type e, const T &t);
+
+        /*
+        Read-modify-write of an arithmetic or blob value under one lock acquisition. The result is range
+        checked, saved and notified like Set.
+        Update calls fn(T &value) with the current value and returns true if the value changed,
+        an out of range result is dropped.
+        CompareExchange sets desired if the value equals expected (bitwise) and returns true, otherwise
+        copies the current value into expected and returns false. An out of range desired returns false.
+        FetchAdd/FetchSub return the previous value, the result saturates at the MetaData min/max.
+        T is never deduced from delta, it must name the entry type.
+        After a type mismatch nothing is written, they return false (FetchAdd/FetchSub a default T).
+
+        example usage:
+        DB<CONFIG>::Update<Certificate>(CERT, [](Certificate &cert) { cert.version++; });
+        uint8_t retries = DB<CONFIG>::FetchAdd<uint8_t>(CONNECTION_RETRIES, 1);
+        */
+        template <class T, class Fn>
+        bool Update(E::enum_type e, Fn &&fn);
 
         template <class T>
-        static bool Set(E::enum_type e, const T &t);
+        bool CompareExchange(E::enum_type e, T &expected, const T &desired);
+
+        template <Arithmetic T>
+        T FetchAdd(E::enum_type e, std::type_identity_t<T> delta);
+
+        template <Arithmetic T>
+        T FetchSub(E::enum_type e, std::type_identity_t<T> delta);
+
+        // Stages several writes and applies them together, see Transaction below
+        class Transaction;
 
         template <class Visitor>
-        static void Visit(E::enum_type e, Visitor &visitor);
+        void Visit(E::enum_type e, Visitor &visitor);
 
         template <class Visitor>
-        static void VisitEach(Visitor &visitor);
+        void VisitEach(Visitor &visitor);
 
         template <class Visitor>
-        static void VisitRawEach(Visitor &visitor);
+        void VisitRawEach(Visitor &visitor);
+
+        template <class Visitor>
+        void VisitRaw(E::enum_type e, Visitor &visitor);
+
+        // every change of an entry stamps it with the next value of a global epoch
+        uint32_t CurrentEpoch();
 
+        // Visits only the entries changed after epoch and returns the epoch to pass to the next call.
+        // an entry changed during the call may be visited again next time, but is never missed
         template <class Visitor>
-        static void VisitRaw(E::enum_type e, Visitor &visitor);
+        uint32_t ChangedSince(uint32_t epoch, Visitor &visitor);
+
+        // Copies the whole DB under one lock acquisition, see SnapshotView below
+        class SnapshotView;
+        SnapshotView Snapshot();
+
+        // Leases reference a value in place while holding its lock, see ReadLease and WriteLease below
+        template <class T>
+        class ReadLease;
+
+        template <class T>
+        class WriteLease;
+
+        template <class T>
+        ReadLease<T> Read(E::enum_type e);
+
+        template <class T>
+        WriteLease<T> Write(E::enum_type e);
+
+        /*
+        Binary delta for syncing databases of the same META_MAP between nodes.
+        [header: magic, version, META_MAP fingerprint, record count, crc32 of the records]
+        records: [key index: u16][length: u16][value bytes], strings hold only their live bytes and NUL.
+        values are in native byte order, like the data buffer.
+        */
+        static constexpr size_t MaxDeltaSize();
+
+        // writes the keys (all by default) as seen at one point in time into out.
+        // returns the bytes written, 0 if out is too small
+        size_t ExportDelta(std::span<uint8_t> out, const KeySet &keys = KeySet{}.set());
+
+        // validates the whole delta, then applies it as one batch with one backend save.
+        // returns false and applies nothing if the delta is malformed, of another META_MAP or out of range
+        bool ImportDelta(std::span<const uint8_t> in);
 
         // Observer interface. Called when a value is changed
         class IObserver
@@ -108,42 +299,893 @@ namespace Shooby
             virtual ~IObserver() = default;
             virtual void OnSet(E::enum_type e, bool changed) = 0;
 
-        private:
-            friend class DB;
-            IObserver *next = nullptr;
+            // Called once per committed transaction with the staged keys and the ones that actually changed.
+            // by default forwards every staged key to OnSet
+            virtual void OnSetMany(const KeySet &keys, const KeySet &changed)
+            {
+                for (size_t i = 0; i < E::NUM; i++)
+                    if (keys.test(i))
+                        OnSet(static_cast<E::enum_type>(i), changed.test(i));
+            }
+
         };
 
-        static void SetObserver(IObserver *observer);
+        // Registers an observer for the given keys (all keys by default).
+        // Set only calls the observers subscribed to the key it changes.
+        // returns false and registers nothing if SHOOBY_MAX_OBSERVERS observers are already registered
+        bool SetObserver(IObserver *observer, const KeySet &keys = KeySet{}.set());
+
+#if SHOOBY_WRITE_BEHIND
+        struct WriteBehindStats
+        {
+            size_t queue_depth;      // dirty entries waiting for the flusher
+            size_t flushes;          // flushes that saved at least one entry
+            size_t saved_entries;    // entries handed to the backend
+            size_t coalesced_writes; // changes to an entry that was already dirty
+            uint32_t last_flush_us;
+            uint32_t max_flush_us;
+        };
+
+        // saves every entry that is dirty at the time of the call before returning
+        void Flush();
+
+        WriteBehindStats GetWriteBehindStats();
+#endif
+
+#if SHOOBY_DEFERRED_PERSIST
+        // saves every dirty entry in one backend batch, in offset order
+        void Flush();
+
+        // true if e changed since the last flush
+        bool IsDirty(E::enum_type e) { return m_dirty.Test(e); }
+        size_t DirtyCount() { return m_dirty.Count(); }
+#endif
+
+#if SHOOBY_ASYNC_OBSERVERS
+        struct NotifierStats
+        {
+            size_t queue_depth;     // events waiting for the notifier thread
+            size_t max_queue_depth;
+            size_t delivered;       // events passed to observers
+            size_t dropped;         // events discarded by the drop oldest overflow policy
+            size_t coalesced;       // events merged into a pending notification of the same key
+            uint32_t last_lag_us;   // time from Set to delivery of the last event
+            uint32_t max_lag_us;
+        };
+
+        // returns after every notification posted before the call was delivered.
+        // before Init and after Shutdown the pending notifications are delivered on the calling thread.
+        // must not be called from an observer
+        void FlushObservers();
+
+        NotifierStats GetNotifierStats();
+#endif
+
+#if SHOOBY_WRITE_BEHIND || SHOOBY_ASYNC_OBSERVERS
+        // stops the background threads, saving and delivering what is left. call before exit
+        void Shutdown();
+#endif
+
+#if SHOOBY_STATS
+        struct EntryStats
+        {
+            uint64_t gets;
+            uint64_t sets;
+            uint64_t changed;
+            LatencyHistogram::Counts lock_wait;         // Set waiting for the entry lock
+            LatencyHistogram::Counts set_if_changed;    // compare and copy into the buffer
+            LatencyHistogram::Counts backend_save;      // saving (or queueing) one changed entry
+            LatencyHistogram::Counts observer_dispatch; // calling OnSet of the subscribed observers
+        };
+
+        // calls visitor(e, MetaData, const EntryStats &) for every entry, without locking.
+        // counters of an entry may be updated while they are read, totals can be off by the calls in flight
+        template <class Visitor>
+        void VisitStats(Visitor &visitor);
+
+        void ResetStats();
+#endif
+
+#if SHOOBY_LOCK_PROFILING
+        struct LockSiteProfile
+        {
+            const char *site;
+            LockProfile::Counts counts;
+            const char *max_hold_key; // name of the entry, "ALL" for whole DB locks
+        };
+
+        // calls visitor(const LockSiteProfile &) for every call site that took a lock, longest max hold time first
+        template <class Visitor>
+        void VisitLockProfile(Visitor &visitor);
+
+        void ResetLockProfile();
+#endif
 
         static const char *get_name(E::enum_type e) { return E::META_MAP[e].name; }
         static size_t get_size(E::enum_type e) { return E::META_MAP[e].size; }
 
     private:
-        // CTORS
-        DB(const DB &) = delete;
-        DB &operator=(const DB &) = delete;
-        DB(DB &&) = delete;
-        DB &operator=(DB &&) = delete;
-
         // DATA RELATED
         static inline constexpr size_t required_data_buffer_size = required_buffer_size<E>();
-        static inline constinit uint8_t DATA_BUFFER[required_data_buffer_size]{};
-        static size_t get_offset(E::enum_type e);
+        static inline constexpr size_t data_buffer_alignment = max_entry_alignment<E>();
+        alignas(data_buffer_alignment) uint8_t m_data[required_data_buffer_size]{};
+        static inline constexpr uint32_t fingerprint = schema_fingerprint<E>();
+        static_assert(max_entry_size<E>() <= UINT16_MAX, "entries are limited to 65535 bytes");
+#if SHOOBY_MMAP_BUFFER
+        static_assert(data_buffer_alignment <= 64, "the mapped data buffer is only 64 bytes aligned");
+        MappedImage m_image{};
+        uint8_t *buffer() { return m_image.Mapped() ? m_image.Data() : m_data; }
+#else
+        uint8_t *buffer() { return m_data; }
+#endif
+        uint8_t *entry_data(E::enum_type e) { return buffer() + get_offset(e); }
+        static inline constexpr auto OFFSETS = offsets_table<E>();
+        static constexpr size_t get_offset(E::enum_type e) { return OFFSETS[e]; }
+        static inline constexpr size_t max_data_entry_size = max_entry_size<E>();
+
+        // copies exactly size bytes of the value of e, locked or lock free according to SHOOBY_SEQLOCK_READS
+        void read_fixed(E::enum_type e, void *dst, size_t size);
+
+        // range check of an arithmetic value of entry e
+        template <Arithmetic T>
+        static bool in_allowed_range(E::enum_type e, T t);
 
+        // MetaData min/max of an arithmetic entry e
+        template <Arithmetic T>
+        static T range_min(E::enum_type e);
+        template <Arithmetic T>
+        static T range_max(E::enum_type e);
+
+        // ATOMIC ENTRIES, arithmetic entries accessed with atomic loads and stores when SHOOBY_ATOMIC_ARITHMETIC is 1
+        static constexpr bool is_atomic(E::enum_type e)
+        {
+            return SHOOBY_ATOMIC_ARITHMETIC && not std::holds_alternative<const char *>(E::META_MAP[e].default_val) &&
+                   not std::holds_alternative<const void *>(E::META_MAP[e].default_val);
+        }
+
+#if SHOOBY_ATOMIC_ARITHMETIC
+        static_assert(std::atomic_ref<uint8_t>::is_always_lock_free && std::atomic_ref<uint16_t>::is_always_lock_free &&
+                          std::atomic_ref<uint32_t>::is_always_lock_free,
+                      "SHOOBY_ATOMIC_ARITHMETIC needs lock free 1, 2 and 4 byte atomics");
+#endif
+
+        // STRINGS, the length prefix is stored right before the value
+        static constexpr bool is_string(E::enum_type e) { return std::holds_alternative<const char *>(E::META_MAP[e].default_val); }
+        static size_t string_length(const uint8_t *value);
+
+        // bytes of the value stored at value (in a buffer laid out like the data buffer), the live part for strings
+        static size_t live_size(E::enum_type e, const uint8_t *value);
+
+        // copies a value into a buffer laid out like the data buffer. for strings size is the length + 1,
+        // only the chars are read from src and the NUL and length prefix are written
+        static void store_value(E::enum_type e, uint8_t *dst, const void *src, size_t size);
+
+        // after loading raw values: terminates every string and sets its length prefix
+        void fix_string_lengths();
+
+        // pointer to the value bytes of a Set argument
+        template <class T>
+        static const void *source_of(const T &t);
+
+        // copy one entry out of the buffer, locked or lock free according to SHOOBY_SEQLOCK_READS.
+        // returns the bytes copied, the live part for strings
+        size_t read_entry(E::enum_type e, void *dst);
+
+        // every write to the buffer goes through here. must be called with the entry stripe locked
+        void write_entry(E::enum_type e, const void *src, size_t size);
+
+        template <class T>
+        bool set_if_changed(E::enum_type e, const T &src, size_t size);
+
+        // stamps a changed entry with the next epoch. must be called with the entry stripe locked
+        void mark_modified(E::enum_type e);
+
+        void reset_buffer();
+
+        // type checks for Get, calls ON_SHOOBY_TYPE_MISMATCH and returns false if T doesn't match entry e
+        template <class T>
+        static bool check_get_type(E::enum_type e);
+        static const void *get_default(E::enum_type e);
+
+        // bytes to copy from src for entry e, the live part for strings
+        static size_t value_size(E::enum_type e, const void *src);
+
+        // range check of the raw value of entry e, true for strings and blobs
+        static bool in_range(E::enum_type e, const void *data);
+
+        // type and range checks for Set. updates size for strings, returns false if value is out of range
         template <class T>
-        static bool set_if_changed(void *dst, const T &src, size_t size);
+        static bool validate(E::enum_type e, const T &t, size_t &size);
+
+        // sets a validated value under the entry lock, persists and notifies. returns true if it changed
+        template <class T>
+        bool apply(E::enum_type e, const T &t, size_t size);
+
+        // copies the value of e into a T under the entry lock and calls fn(T &value). if fn returns true
+        // the value is set like apply (dropped if out of range) and observers are notified
+        template <class T, class Fn>
+        bool modify(E::enum_type e, Fn &&fn);
+
+        // adds delta to an arithmetic value, saturating at its min/max. returns the previous value
+        template <Arithmetic T>
+        T fetch_add(E::enum_type e, double delta);
+
+        // applies the keys under one lock, source(e) returns a pointer to the new value of e.
+        // changed values are saved in one backend batch, returns the changed keys
+        template <class Source>
+        KeySet apply_batch(const KeySet &keys, Source &&source);
+
+        // notify/notify_many call the observers, or post to the notifier thread in async mode
+        void notify(E::enum_type e, bool changed);
+        void notify_many(const KeySet &keys, const KeySet &changed);
+        static value_variant_t make_value(E::enum_type e, const void *data);
+
+        // DELTA FORMAT
+        struct DeltaHeader
+        {
+            uint32_t magic;
+            uint16_t version;
+            uint16_t count;
+            uint32_t fingerprint;
+            uint32_t crc;
+        };
+
+        static constexpr uint32_t DELTA_MAGIC = 0x44424853; // "SHBD"
+        static constexpr uint16_t DELTA_VERSION = 1;
+        static constexpr size_t DELTA_RECORD_HEADER = 2 * sizeof(uint16_t);
+        static_assert(E::NUM <= UINT16_MAX && max_entry_size<E>() <= UINT16_MAX, "META_MAP too big for the delta format");
 
         // INITIALIZATION RELATED
-        static constinit inline bool s_is_initialized = false;
+        bool m_is_initialized = false;
+
+        // EPOCHS, an entry is stamped under its stripe lock
+        std::atomic<uint32_t> m_epoch{0};
+        std::atomic<uint32_t> m_modified[E::NUM]{};
 
         // BACKEND
-        static inline IBackend *s_backend{};
+        IBackend *m_backend{};
+
+        // the backend keeps a data buffer image, see IBackend::SaveImage
+        std::atomic<bool> m_backend_image{false};
+        void load_from_backend();
+        void save_image(size_t offset, const void *data, size_t size);
+
+        // scratch space for backend batches, guarded by AllLock
+        BackendEntry m_batch[E::NUM]{};
+
+        // called with the entry stripe locked after the entry changed
+        void persist(E::enum_type e);
+
+        // called with all stripes locked after the changed keys were applied, m_batch holds their entries
+        void persist_batch(const KeySet &changed, size_t count);
+
+        // saves the first count entries of m_batch and their image regions. must be called with all stripes locked
+        void save_batch(size_t count);
+
+        // called without any DB lock after a change, flushes once SHOOBY_DEFERRED_AUTO_FLUSH keys are dirty
+        void auto_flush()
+        {
+#if SHOOBY_DEFERRED_PERSIST && SHOOBY_DEFERRED_AUTO_FLUSH > 0
+            if (m_dirty.Count() >= SHOOBY_DEFERRED_AUTO_FLUSH)
+                Flush();
+#endif
+        }
+
+#if SHOOBY_DEFERRED_PERSIST
+        // changed entries not handed to the backend yet
+        AtomicBitset<E::NUM> m_dirty{};
+#endif
+
+#if SHOOBY_WRITE_BEHIND
+        void flusher_main();
+
+        struct WriteBehind
+        {
+            AtomicBitset<E::NUM> dirty{};
+            std::atomic<bool> pending{false};
+
+            // serializes flushes, guards the flush copy buffer and entries
+            std::mutex flush_mutex{};
+            alignas(data_buffer_alignment) uint8_t buffer[required_data_buffer_size]{};
+            BackendEntry entries[E::NUM]{};
+
+            std::mutex wake_mutex{};
+            std::condition_variable wake{};
+            bool stop = false;
+
+            std::atomic<size_t> flushes{0};
+            std::atomic<size_t> saved_entries{0};
+            std::atomic<size_t> coalesced_writes{0};
+            std::atomic<uint32_t> last_flush_us{0};
+            std::atomic<uint32_t> max_flush_us{0};
+
+            std::thread thread{};
+        };
+
+        WriteBehind m_write_behind{};
+#endif
+
+#if SHOOBY_WRITE_BEHIND || SHOOBY_ASYNC_OBSERVERS
+        // joins the background threads and saves the dirty entries left, without delivering pending notifications
+        void stop_threads();
+#endif
+
+        // INSTRUMENTATION, the helpers compile to nothing when SHOOBY_STATS is 0
+        struct KeyStats
+        {
+            std::atomic<uint64_t> gets{0};
+            std::atomic<uint64_t> sets{0};
+            std::atomic<uint64_t> changed{0};
+            LatencyHistogram lock_wait{};
+            LatencyHistogram set_if_changed{};
+            LatencyHistogram backend_save{};
+            LatencyHistogram observer_dispatch{};
+        };
+
+#if SHOOBY_STATS
+        KeyStats m_stats[E::NUM]{};
+#endif
+
+        static uint64_t stats_now()
+        {
+#if SHOOBY_STATS
+            return monotonic_ns();
+#else
+            return 0;
+#endif
+        }
+
+        void count_stat(E::enum_type e, std::atomic<uint64_t> KeyStats::*counter)
+        {
+#if SHOOBY_STATS
+            (m_stats[e].*counter).fetch_add(1, std::memory_order_relaxed);
+#endif
+        }
+
+        // records the time from start (a stats_now() value) until now
+        void record_latency(E::enum_type e, LatencyHistogram KeyStats::*histogram, uint64_t start)
+        {
+#if SHOOBY_STATS
+            (m_stats[e].*histogram).Record(stats_now() - start);
+#endif
+        }
 
         // OBSERVER CALLBACK
-        static inline IObserver *s_observer{};
+        static_assert(SHOOBY_MAX_OBSERVERS > 0 && SHOOBY_MAX_OBSERVERS <= 64, "SHOOBY_MAX_OBSERVERS must be 1..64");
+        using observer_mask_t = std::conditional_t<(SHOOBY_MAX_OBSERVERS > 32), uint64_t, uint32_t>;
+
+        // observers by registration order, bit i of a subscriber mask refers to m_observers[i].
+        // the keys are kept per instance, one observer can watch several instances
+        IObserver *m_observers[SHOOBY_MAX_OBSERVERS]{};
+        KeySet m_observer_keys[SHOOBY_MAX_OBSERVERS]{};
+        std::atomic<size_t> m_observer_count{0};
+        std::atomic<observer_mask_t> m_subscribers[E::NUM]{};
+
+        // calls the observers in mask with OnSet
+        void dispatch(E::enum_type e, bool changed, observer_mask_t mask);
+
+#if SHOOBY_ASYNC_OBSERVERS
+        void post(E::enum_type e, bool changed);
+        size_t deliver_pending();
+        void notifier_main();
+        void start_notifier();
+
+        struct Event
+        {
+            uint32_t key;
+            bool changed;
+            observer_mask_t subscribers;
+            uint64_t posted_ns;
+        };
+
+        struct Notifier
+        {
+            MpmcQueue<Event, SHOOBY_ASYNC_QUEUE_SIZE> queue{};
+
+            // coalesce policy: keys whose events didn't fit in the queue
+            AtomicBitset<E::NUM> overflow{};
+            AtomicBitset<E::NUM> overflow_changed{};
+            std::atomic<observer_mask_t> overflow_subscribers[E::NUM]{};
+            std::atomic<bool> has_overflow{false};
+
+            // every posted event is completed exactly once: delivered, dropped or coalesced
+            std::atomic<size_t> posted{0};
+            std::atomic<size_t> completed{0};
+
+            // bumped by producers to wake the notifier thread
+            std::atomic<uint32_t> signal{0};
+            std::atomic<bool> stop{false};
+            // the notifier thread is delivering, otherwise FlushObservers delivers on the caller thread
+            std::atomic<bool> running{false};
+
+            std::atomic<size_t> max_queue_depth{0};
+            std::atomic<size_t> delivered{0};
+            std::atomic<size_t> dropped{0};
+            std::atomic<size_t> coalesced{0};
+            std::atomic<uint32_t> last_lag_us{0};
+            std::atomic<uint32_t> max_lag_us{0};
+
+            std::thread thread{};
+
+            void Wake()
+            {
+                signal.fetch_add(1, std::memory_order_release);
+                signal.notify_one();
+            }
+
+            void Complete(size_t count)
+            {
+                completed.fetch_add(count, std::memory_order_release);
+                completed.notify_all();
+            }
+        };
+
+        Notifier m_notifier{};
+#endif
 
         // SYNCHRONIZATION
-        static inline SHOOBY_MUTEX_TYPE s_mutex{};
+        struct alignas(64) Stripe
+        {
+            SHOOBY_SHARED_MUTEX_TYPE mutex{};
+#if SHOOBY_SEQLOCK_READS
+            SeqLock seqlock{};
+#endif
+        };
+
+        static inline constexpr size_t lock_stripes = SHOOBY_LOCK_STRIPES < E::NUM ? SHOOBY_LOCK_STRIPES : E::NUM;
+        static_assert(lock_stripes > 0, "SHOOBY_LOCK_STRIPES must be positive");
+        Stripe m_stripes[lock_stripes]{};
+        Stripe &get_stripe(E::enum_type e) { return m_stripes[e % lock_stripes]; }
+
+        // locks all stripes in index order, for whole DB operations
+        class AllLock
+        {
+        public:
+            AllLock(Stripe *stripes) : stripes(stripes)
+            {
+                for (size_t i = 0; i < lock_stripes; i++)
+                    SHOOBY_LOCK_EXCLUSIVE(stripes[i].mutex);
+            }
+
+            ~AllLock()
+            {
+                for (size_t i = lock_stripes; i > 0; i--)
+                    SHOOBY_UNLOCK_EXCLUSIVE(stripes[i - 1].mutex);
+            }
+
+            AllLock(const AllLock &) = delete;
+            AllLock &operator=(const AllLock &) = delete;
+            AllLock(AllLock &&) = delete;
+            AllLock &operator=(AllLock &&) = delete;
+
+        private:
+            Stripe *stripes;
+        };
+
+        // locks all stripes shared in index order, for whole DB reads
+        class AllSharedLock
+        {
+        public:
+            AllSharedLock(Stripe *stripes) : stripes(stripes)
+            {
+                for (size_t i = 0; i < lock_stripes; i++)
+                    SHOOBY_LOCK_SHARED(stripes[i].mutex);
+            }
+
+            ~AllSharedLock()
+            {
+                for (size_t i = lock_stripes; i > 0; i--)
+                    SHOOBY_UNLOCK_SHARED(stripes[i - 1].mutex);
+            }
+
+            AllSharedLock(const AllSharedLock &) = delete;
+            AllSharedLock &operator=(const AllSharedLock &) = delete;
+            AllSharedLock(AllSharedLock &&) = delete;
+            AllSharedLock &operator=(AllSharedLock &&) = delete;
+
+        private:
+            Stripe *stripes;
+        };
+
+        // LOCK PROFILING, the call site of every lock
+        enum LockSite : uint8_t
+        {
+            INIT,
+            GET,
+            SET,
+            BATCH, // Reset, Transaction::Commit and ImportDelta
+            VISIT,
+            SNAPSHOT, // Snapshot and ExportDelta
+            LEASE,
+            FLUSH,
+            OBSERVER,
+            LOCK_SITES
+        };
+
+#if SHOOBY_LOCK_PROFILING
+        static constexpr const char *LOCK_SITE_NAMES[LOCK_SITES] = {"Init", "Get", "Set", "Batch", "Visit", "Snapshot", "Lease", "Flush", "Observer"};
+        LockProfile m_lock_profiles[LOCK_SITES]{};
+#endif
+
+        // timestamps of one lock acquisition, empty when SHOOBY_LOCK_PROFILING is 0.
+        // created right before locking, Acquired() is called right after
+        struct LockTimer
+        {
+#if SHOOBY_LOCK_PROFILING
+            uint64_t start = monotonic_ns();
+            uint64_t acquired = 0;
+            void Acquired() { acquired = monotonic_ns(); }
+#else
+            void Acquired() {}
+#endif
+        };
+
+        // called right before unlocking, key is E::NUM for whole DB locks
+        void lock_released(const LockTimer &timer, LockSite site, size_t key)
+        {
+#if SHOOBY_LOCK_PROFILING
+            m_lock_profiles[site].Record(timer.acquired - timer.start, monotonic_ns() - timer.acquired, key);
+#endif
+        }
+
+        // a lock guard of a call site, profiled when SHOOBY_LOCK_PROFILING is 1
+        template <class Guard>
+        class SiteLock
+        {
+        public:
+            // locks the stripe of e
+            SiteLock(DBInstance &db, LockSite site, E::enum_type e) : SiteLock(db, site, e, db.get_stripe(e).mutex) {}
+
+            // locks all stripes
+            SiteLock(DBInstance &db, LockSite site) : SiteLock(db, site, E::NUM, db.m_stripes) {}
+
+            ~SiteLock() { db.lock_released(timer, site, key); }
+
+            SiteLock(const SiteLock &) = delete;
+            SiteLock &operator=(const SiteLock &) = delete;
+
+        private:
+            template <class Lockable>
+            SiteLock(DBInstance &db, LockSite site, size_t key, Lockable &lockable) : db(db), site(site), key(key), guard(lockable)
+            {
+                timer.Acquired();
+            }
+
+            DBInstance &db;
+            LockSite site;
+            size_t key;
+            LockTimer timer{}; // before guard, starts timing before the lock is taken
+            Guard guard;
+        };
+
+        using EntryLock = SiteLock<ExclusiveLock<SHOOBY_SHARED_MUTEX_TYPE>>;
+        using EntrySharedLock = SiteLock<SharedLock<SHOOBY_SHARED_MUTEX_TYPE>>;
+        using DBLock = SiteLock<AllLock>;
+        using DBSharedLock = SiteLock<AllSharedLock>;
+    };
+
+    /*
+        Stages typed writes to several entries and applies them under one lock acquisition,
+        with one backend SaveBatch and one OnSetMany per observer.
+        Readers never see a half applied transaction.
+
+        example usage:
+        DB<CONFIG>::Transaction transaction; // or DBInstance<CONFIG>::Transaction transaction(shard);
+        transaction.Set(PORT, uint16_t(8883));
+        transaction.Set(HOST, "broker.local");
+        auto changed = transaction.Commit();
+    */
+    template <EnumMetaMap E>
+    class DBInstance<E>::Transaction
+    {
+    public:
+        explicit Transaction(DBInstance &db) : db(db) {}
+
+        // same checks as DB::Set. returns false and stages nothing if the value is out of range
+        template <class T>
+        bool Set(E::enum_type e, const T &t);
+
+        // applies all staged values and clears the transaction, returns the keys that changed
+        KeySet Commit();
+
+        void Clear() { staged.reset(); }
+        const KeySet &Staged() const { return staged; }
+
+    private:
+        DBInstance &db;
+        KeySet staged{};
+        alignas(data_buffer_alignment) uint8_t data[required_data_buffer_size]{};
+    };
+
+    /*
+        A consistent copy of the whole DB taken by DB::Snapshot() under one lock acquisition.
+        Offers the DB read API without any locking, for diagnostics dumps, config export and telemetry.
+        Pointers returned by Get<Pointer T> point into the snapshot and are valid as long as it is.
+
+        example usage:
+        auto snapshot = DB<CONFIG>::Snapshot();
+        auto port = snapshot.Get<uint16_t>(PORT);
+        snapshot.VisitEach(visitor);
+    */
+    template <EnumMetaMap E>
+    class DBInstance<E>::SnapshotView
+    {
+    public:
+        template <NotPointer T>
+        T Get(E::enum_type e) const;
+
+        template <Pointer T>
+        T Get(E::enum_type e) const;
+
+        template <E::enum_type e>
+        FixedString<E::META_MAP[e].size> GetString() const;
+
+        template <class Visitor>
+        void Visit(E::enum_type e, Visitor &visitor) const;
+
+        template <class Visitor>
+        void VisitEach(Visitor &visitor) const;
+
+        template <class Visitor>
+        void VisitRaw(E::enum_type e, Visitor &visitor) const;
+
+        template <class Visitor>
+        void VisitRawEach(Visitor &visitor) const;
+
+    private:
+        friend class DBInstance;
+        SnapshotView() = default;
+
+        const uint8_t *entry_data(E::enum_type e) const { return data + DBInstance::get_offset(e); }
+
+        alignas(data_buffer_alignment) uint8_t data[required_data_buffer_size];
+    };
+
+    /*
+        A read lease returned by DB::Read<T>(e) references the value in the data buffer without copying it
+        and holds the entry lock until it is destroyed, so the value can't change while it is used.
+        T is the value type, or std::string_view for strings. On a type mismatch the lease is empty,
+        it converts to false and holds no lock.
+        Don't call other DB functions on the same key (or lock stripe) while holding a lease.
+
+        example usage:
+        {
+            auto cert = DB<CONFIG>::Read<Certificate>(CERT);
+            tls_send(cert->der, cert->length);
+        }
+    */
+    template <EnumMetaMap E>
+    template <class T>
+    class DBInstance<E>::ReadLease
+    {
+    public:
+        const T &operator*() const
+        {
+            if constexpr (std::is_same_v<T, std::string_view>)
+                return ref;
+            else
+                return *ref;
+        }
+
+        const T *operator->() const { return &**this; }
+
+        explicit operator bool() const { return lock.has_value(); }
+
+        ReadLease(const ReadLease &) = delete;
+        ReadLease &operator=(const ReadLease &) = delete;
+
+    private:
+        friend class DBInstance;
+        ReadLease(DBInstance &db, E::enum_type e, bool valid);
+
+        std::optional<EntrySharedLock> lock{};
+        std::conditional_t<std::is_same_v<T, std::string_view>, std::string_view, const T *> ref;
+    };
+
+    /*
+        A write lease returned by DB::Write<T>(e) lets the value be modified in place under the entry lock.
+        When it is destroyed the value goes through the Set path: an out of range value is reverted,
+        a changed value is persisted, then the observers are notified.
+        Arithmetic and blob values only. On a type mismatch the lease is empty, it converts to false.
+        Lock free readers (SHOOBY_SEQLOCK_READS, SHOOBY_ATOMIC_ARITHMETIC) don't wait for it: the lease
+        edits a copy that is published on release.
+
+        example usage:
+        {
+            auto stats = DB<CONFIG>::Write<Stats>(STATS);
+            stats->reconnects++;
+        }
+    */
+    template <EnumMetaMap E>
+    template <class T>
+    class DBInstance<E>::WriteLease
+    {
+        static_assert(not std::is_same_v<T, std::string_view> && not std::is_pointer_v<T>,
+                      "strings and pointers can't be written in place");
+
+    public:
+        T &operator*() const { return *value; }
+        T *operator->() const { return value; }
+
+        explicit operator bool() const { return value != nullptr; }
+
+        ~WriteLease();
+
+        WriteLease(const WriteLease &) = delete;
+        WriteLease &operator=(const WriteLease &) = delete;
+
+    private:
+        friend class DBInstance;
+        WriteLease(DBInstance &db, E::enum_type e, bool valid);
+
+        DBInstance &db;
+        typename E::enum_type e;
+        LockTimer timer{};
+        T *value;
+        alignas(T) uint8_t original[sizeof(T)];
+
+        // entries with lock free readers are written on a copy, stored with one atomic store (or one
+        // seqlock write) on release
+        static constexpr bool staged = (SHOOBY_ATOMIC_ARITHMETIC && std::is_arithmetic_v<T>) || SHOOBY_SEQLOCK_READS;
+        alignas(T) uint8_t copy[staged ? sizeof(T) : 1];
+    };
+
+    /*
+        The static DB API of a META_MAP, every call goes to one default DBInstance.
+        For the common case of a single copy of a META_MAP per process, see DBInstance for shards.
+        Default() returns the instance itself, to pass it where a DBInstance is expected.
+    */
+    template <EnumMetaMap E>
+    class DB
+    {
+    public:
+        using Instance = DBInstance<E>;
+        using KeySet = typename Instance::KeySet;
+        using IObserver = typename Instance::IObserver;
+        using SnapshotView = typename Instance::SnapshotView;
+
+        template <E::enum_type K>
+        using value_t = typename Instance::template value_t<K>;
+
+        template <class T>
+        using ReadLease = typename Instance::template ReadLease<T>;
+
+        template <class T>
+        using WriteLease = typename Instance::template WriteLease<T>;
+
+        // a transaction of the default instance
+        class Transaction : public Instance::Transaction
+        {
+        public:
+            Transaction() : Instance::Transaction(s_instance) {}
+        };
+
+        static Instance &Default() { return s_instance; }
+
+        static void Init(IBackend *backend = nullptr) { s_instance.Init(backend); }
+
+#if SHOOBY_MMAP_BUFFER
+        static bool InitMapped(const char *path) { return s_instance.InitMapped(path); }
+#endif
+
+        static void Reset() { s_instance.Reset(); }
+
+        template <NotPointer T>
+        static T Get(E::enum_type e) { return s_instance.template Get<T>(e); }
+
+        template <Pointer T>
+        static T Get(E::enum_type e) { return s_instance.template Get<T>(e); }
+
+        template <E::enum_type e>
+        static FixedString<E::META_MAP[e].size> GetString() { return s_instance.template GetString<e>(); }
+
+        template <E::enum_type K>
+        static auto Get() { return s_instance.template Get<K>(); }
+
+        template <E::enum_type K, class V>
+            requires Instance::template settable_as<K, V>
+        static bool Set(const V &v) { return s_instance.template Set<K>(v); }
+
+        template <class T>
+        static bool Set(E::enum_type e, const T &t) { return s_instance.Set(e, t); }
+
+        template <class T, class Fn>
+        static bool Update(E::enum_type e, Fn &&fn) { return s_instance.template Update<T>(e, std::forward<Fn>(fn)); }
+
+        template <class T>
+        static bool CompareExchange(E::enum_type e, T &expected, const T &desired) { return s_instance.CompareExchange(e, expected, desired); }
+
+        template <Arithmetic T>
+        static T FetchAdd(E::enum_type e, std::type_identity_t<T> delta) { return s_instance.template FetchAdd<T>(e, delta); }
+
+        template <Arithmetic T>
+        static T FetchSub(E::enum_type e, std::type_identity_t<T> delta) { return s_instance.template FetchSub<T>(e, delta); }
+
+        template <class Visitor>
+        static void Visit(E::enum_type e, Visitor &visitor) { s_instance.Visit(e, visitor); }
+
+        template <class Visitor>
+        static void VisitEach(Visitor &visitor) { s_instance.VisitEach(visitor); }
+
+        template <class Visitor>
+        static void VisitRawEach(Visitor &visitor) { s_instance.VisitRawEach(visitor); }
+
+        template <class Visitor>
+        static void VisitRaw(E::enum_type e, Visitor &visitor) { s_instance.VisitRaw(e, visitor); }
+
+        static uint32_t CurrentEpoch() { return s_instance.CurrentEpoch(); }
+
+        template <class Visitor>
+        static uint32_t ChangedSince(uint32_t epoch, Visitor &visitor) { return s_instance.ChangedSince(epoch, visitor); }
+
+        static SnapshotView Snapshot() { return s_instance.Snapshot(); }
+
+        template <class T>
+        static ReadLease<T> Read(E::enum_type e) { return s_instance.template Read<T>(e); }
+
+        template <class T>
+        static WriteLease<T> Write(E::enum_type e) { return s_instance.template Write<T>(e); }
+
+        static constexpr size_t MaxDeltaSize() { return Instance::MaxDeltaSize(); }
+
+        static size_t ExportDelta(std::span<uint8_t> out, const KeySet &keys = KeySet{}.set()) { return s_instance.ExportDelta(out, keys); }
+
+        static bool ImportDelta(std::span<const uint8_t> in) { return s_instance.ImportDelta(in); }
+
+        static bool SetObserver(IObserver *observer, const KeySet &keys = KeySet{}.set()) { return s_instance.SetObserver(observer, keys); }
+
+#if SHOOBY_WRITE_BEHIND
+        using WriteBehindStats = typename Instance::WriteBehindStats;
+
+        static void Flush() { s_instance.Flush(); }
+
+        static WriteBehindStats GetWriteBehindStats() { return s_instance.GetWriteBehindStats(); }
+#endif
+
+#if SHOOBY_DEFERRED_PERSIST
+        static void Flush() { s_instance.Flush(); }
+
+        static bool IsDirty(E::enum_type e) { return s_instance.IsDirty(e); }
+        static size_t DirtyCount() { return s_instance.DirtyCount(); }
+#endif
+
+#if SHOOBY_ASYNC_OBSERVERS
+        using NotifierStats = typename Instance::NotifierStats;
+
+        static void FlushObservers() { s_instance.FlushObservers(); }
+
+        static NotifierStats GetNotifierStats() { return s_instance.GetNotifierStats(); }
+#endif
+
+#if SHOOBY_WRITE_BEHIND || SHOOBY_ASYNC_OBSERVERS
+        static void Shutdown() { s_instance.Shutdown(); }
+#endif
+
+#if SHOOBY_STATS
+        using EntryStats = typename Instance::EntryStats;
+
+        template <class Visitor>
+        static void VisitStats(Visitor &visitor) { s_instance.VisitStats(visitor); }
+
+        static void ResetStats() { s_instance.ResetStats(); }
+#endif
+
+#if SHOOBY_LOCK_PROFILING
+        using LockSiteProfile = typename Instance::LockSiteProfile;
+
+        template <class Visitor>
+        static void VisitLockProfile(Visitor &visitor) { s_instance.VisitLockProfile(visitor); }
+
+        static void ResetLockProfile() { s_instance.ResetLockProfile(); }
+#endif
+
+        static const char *get_name(E::enum_type e) { return Instance::get_name(e); }
+        static size_t get_size(E::enum_type e) { return Instance::get_size(e); }
+
+    private:
+        DB() = delete;
+
+        static inline Instance s_instance{};
     };
 
 #include "shooby_db_inl.hpp"
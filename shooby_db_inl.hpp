@@ -1,148 +1,475 @@
 
 
 template <EnumMetaMap E>
-void DB<E>::Init(IBackend *backend)
+DBInstance<E>::~DBInstance()
 {
-    SHOOBY_MUTEX_INIT(s_mutex);
-    s_backend = backend;
+#if SHOOBY_WRITE_BEHIND || SHOOBY_ASYNC_OBSERVERS
+    // the threads use the members, they are stopped before any member is destroyed.
+    // dirty entries are still saved, the backend must outlive the DB
+    stop_threads();
+#endif
+}
+
+template <EnumMetaMap E>
+void DBInstance<E>::Init(IBackend *backend)
+{
+    for (size_t i = 0; i < lock_stripes; i++)
+        SHOOBY_SHARED_MUTEX_INIT(m_stripes[i].mutex);
 
-    Reset();
-    if (s_backend != nullptr)
+#if SHOOBY_WRITE_BEHIND || SHOOBY_DEFERRED_PERSIST
+    // pending writes belong to the backend being replaced
+    if (m_is_initialized)
+        Flush();
+#endif
+
+#if SHOOBY_WRITE_BEHIND
+    // the flusher reads m_backend under the flush mutex, it waits while the backend is swapped
+    std::lock_guard flush_lock(m_write_behind.flush_mutex);
+#endif
+
+    DBLock lock(*this, INIT);
+    m_backend = backend;
+
+    reset_buffer();
+    m_backend_image = false;
+    if (m_backend != nullptr)
     {
-        s_backend->Init();
+        m_backend->Init();
+        load_from_backend();
+        fix_string_lengths();
+    }
 
-        for (int i = 0; i < E::NUM; i++)
-        {
-            typename E::enum_type e = static_cast<E::enum_type>(i);
-            bool entry_found = s_backend->Load(get_name(e), DATA_BUFFER + get_offset(e), get_size(e));
-            if (not entry_found)
-            {
-                SHOOBY_DEBUG_PRINT("shooby_db: entry not found: %s, saving default\n", get_name(e));
-                s_backend->Save(get_name(e), DATA_BUFFER + get_offset(e), get_size(e));
-            }
-        }
+    m_is_initialized = true;
+
+#if SHOOBY_WRITE_BEHIND
+    if (m_backend != nullptr && not m_write_behind.thread.joinable())
+    {
+        m_write_behind.stop = false;
+        m_write_behind.thread = std::thread(&DBInstance::flusher_main, this);
     }
+#endif
+
+#if SHOOBY_ASYNC_OBSERVERS
+    start_notifier();
+#endif
 
-    s_is_initialized = true;
     SHOOBY_DEBUG_PRINT("shooby_db: initialized with backend\n");
 }
 
-// reset buffer to default!
+// must be called with all stripes locked
 template <EnumMetaMap E>
-void DB<E>::Reset()
+void DBInstance<E>::load_from_backend()
 {
-    size_t offset = 0;
+    // matching layout: the whole buffer in one read
+    if (m_backend->LoadImage(fingerprint, buffer(), required_data_buffer_size))
+    {
+        SHOOBY_DEBUG_PRINT("shooby_db: loaded data buffer image\n");
+        m_backend_image = true;
+        return;
+    }
+
+    // no image or another layout: load by name, then rewrite the image
+    for (int i = 0; i < E::NUM; i++)
+    {
+        typename E::enum_type e = static_cast<E::enum_type>(i);
+        m_batch[i] = {get_name(e), entry_data(e), get_size(e)};
+    }
 
+    m_backend->LoadAll(std::span<BackendEntry>(m_batch, E::NUM));
+
+    size_t missing = 0;
     for (int i = 0; i < E::NUM; i++)
     {
-        size_t size = E::META_MAP[i].size;
+        if (m_batch[i].found)
+            continue;
+
+        SHOOBY_DEBUG_PRINT("shooby_db: entry not found: %s, saving default\n", m_batch[i].name);
+        m_batch[missing++] = m_batch[i];
+    }
+
+    if (missing > 0)
+        m_backend->SaveBatch(std::span<const BackendEntry>(m_batch, missing));
+
+    m_backend_image = m_backend->SaveImage(fingerprint, 0, buffer(), required_data_buffer_size);
+    if (not m_backend_image)
+        m_backend->InvalidateImage();
+}
+
+// called before the values are saved by name. an image that missed a write is dropped, otherwise
+// the next Init would load it and roll back every value saved by name since
+template <EnumMetaMap E>
+void DBInstance<E>::save_image(size_t offset, const void *data, size_t size)
+{
+    if (m_backend_image.load(std::memory_order_relaxed) && not m_backend->SaveImage(fingerprint, offset, data, size))
+    {
+        SHOOBY_DEBUG_PRINT("shooby_db: image write failed, dropping the image\n");
+        m_backend_image.store(false, std::memory_order_relaxed);
+        m_backend->InvalidateImage();
+    }
+}
+
+#if SHOOBY_MMAP_BUFFER
+template <EnumMetaMap E>
+bool DBInstance<E>::InitMapped(const char *path)
+{
+    for (size_t i = 0; i < lock_stripes; i++)
+        SHOOBY_SHARED_MUTEX_INIT(m_stripes[i].mutex);
+
+#if SHOOBY_WRITE_BEHIND
+    std::lock_guard flush_lock(m_write_behind.flush_mutex);
+#endif
 
-        std::visit(Overload{
-                       [size, dst = DATA_BUFFER + offset](auto t)
-                       { memcpy(dst, &t, size); },
-                       [size, dst = DATA_BUFFER + offset](auto *t)
-                       { memcpy(dst, t, size); },
-                   },
-                   E::META_MAP[i].default_val);
+    DBLock lock(*this, INIT);
+    m_backend = nullptr;
 
-        offset += size;
+    bool mapped = m_image.Open(path, fingerprint, required_data_buffer_size);
+    SHOOBY_ASSERT(mapped, "can't map data buffer file");
+
+    bool valid = m_image.Valid();
+    if (not valid)
+    {
+        SHOOBY_DEBUG_PRINT("shooby_db: mapped image layout mismatch, loading defaults\n");
+        reset_buffer();
+        m_image.Stamp();
     }
+    else
+        fix_string_lengths();
+
+    m_is_initialized = true;
 
+#if SHOOBY_ASYNC_OBSERVERS
+    start_notifier();
+#endif
+
+    SHOOBY_DEBUG_PRINT("shooby_db: initialized with mapped buffer\n");
+    return valid;
+}
+#endif
+
+// reset buffer to default!
+template <EnumMetaMap E>
+void DBInstance<E>::Reset()
+{
+    SHOOBY_ASSERT(m_is_initialized, "DB not initialized!");
+    apply_batch(KeySet{}.set(), get_default);
     SHOOBY_DEBUG_PRINT("shooby_db: reset\n");
 }
 
 template <EnumMetaMap E>
-size_t DB<E>::get_offset(E::enum_type e)
+size_t DBInstance<E>::value_size(E::enum_type e, const void *src)
+{
+    if (std::holds_alternative<const char *>(E::META_MAP[e].default_val))
+        return strnlen((const char *)src, get_size(e) - 1) + 1;
+
+    return get_size(e);
+}
+
+template <EnumMetaMap E>
+const void *DBInstance<E>::get_default(E::enum_type e)
+{
+    return std::visit(Overload{
+                          [](const auto &t) -> const void *
+                          { return &t; },
+                          [](const auto *t) -> const void *
+                          { return t; },
+                      },
+                      E::META_MAP[e].default_val);
+}
+
+// must be called with all stripes locked
+template <EnumMetaMap E>
+void DBInstance<E>::reset_buffer()
 {
-    int offset = 0;
-    for (int i = 0; i < e; i++)
+    for (int i = 0; i < E::NUM; i++)
     {
-        offset += E::META_MAP[i].size;
+        typename E::enum_type e = static_cast<E::enum_type>(i);
+        write_entry(e, get_default(e), value_size(e, get_default(e)));
     }
+}
+
+template <EnumMetaMap E>
+size_t DBInstance<E>::string_length(const uint8_t *value)
+{
+    string_length_t length;
+    memcpy(&length, value - sizeof(length), sizeof(length));
+    return length;
+}
+
+template <EnumMetaMap E>
+size_t DBInstance<E>::live_size(E::enum_type e, const uint8_t *value)
+{
+    if (not is_string(e))
+        return get_size(e);
 
-    return offset;
+    // clamped, a lock free reader may see a torn length
+    size_t size = string_length(value) + 1;
+    return size < get_size(e) ? size : get_size(e);
 }
 
 template <EnumMetaMap E>
-template <NotPointer T>
-T DB<E>::Get(E::enum_type e)
+void DBInstance<E>::store_value(E::enum_type e, uint8_t *dst, const void *src, size_t size)
 {
-    SHOOBY_ASSERT(s_is_initialized, "DB not initialized!");
-    T t;
+    if (not is_string(e))
+    {
+        memcpy(dst, src, size);
+        return;
+    }
 
-    // case for blobs
-    if constexpr (not std::is_arithmetic_v<T>)
+    string_length_t length = static_cast<string_length_t>(size - 1);
+    memcpy(dst, src, length);
+    dst[length] = '\0';
+    memcpy(dst - sizeof(length), &length, sizeof(length));
+}
+
+// must be called with all stripes locked
+template <EnumMetaMap E>
+void DBInstance<E>::fix_string_lengths()
+{
+    for (size_t i = 0; i < E::NUM; i++)
     {
-        if (not std::holds_alternative<const void *>(E::META_MAP[e].default_val))
-            ON_SHOOBY_TYPE_MISMATCH("type mismatch! not a blob");
+        typename E::enum_type e = static_cast<E::enum_type>(i);
+        if (not is_string(e))
+            continue;
 
-        if (sizeof(T) != get_size(e))
-            ON_SHOOBY_TYPE_MISMATCH("blob size mismatch!");
+        char *chars = reinterpret_cast<char *>(entry_data(e));
+        chars[get_size(e) - 1] = '\0';
+        string_length_t length = static_cast<string_length_t>(strlen(chars));
+        memcpy(entry_data(e) - sizeof(length), &length, sizeof(length));
     }
+}
 
-    // case for arithmetics
+template <EnumMetaMap E>
+template <class T>
+const void *DBInstance<E>::source_of(const T &t)
+{
+    using raw_type = std::decay_t<T>;
+    if constexpr (std::is_pointer_v<raw_type>)
+        return static_cast<const void *>(t);
+    else if constexpr (std::is_same_v<raw_type, std::string_view>)
+        return t.data();
     else
+        return &t;
+}
+
+template <EnumMetaMap E>
+size_t DBInstance<E>::read_entry(E::enum_type e, void *dst)
+{
+    if (is_atomic(e))
     {
-        if (not std::holds_alternative<T>(E::META_MAP[e].default_val))
-            ON_SHOOBY_TYPE_MISMATCH("type mismatch! not an arithmetic type");
+        atomic_load_bytes(dst, entry_data(e), get_size(e));
+        return get_size(e);
     }
 
-    Lock lock(s_mutex);
-    memcpy(&t, DATA_BUFFER + get_offset(e), get_size(e));
-    return t;
+    size_t size;
+#if SHOOBY_SEQLOCK_READS
+    // writers never hold the sequence odd for longer than a memcpy, so this retries rarely
+    const SeqLock &seqlock = get_stripe(e).seqlock;
+    uint32_t seq;
+    do
+    {
+        seq = seqlock.ReadBegin();
+        size = live_size(e, entry_data(e));
+        memcpy(dst, entry_data(e), size);
+    } while (seqlock.ReadRetry(seq));
+#else
+    EntrySharedLock lock(*this, GET, e);
+    size = live_size(e, entry_data(e));
+    memcpy(dst, entry_data(e), size);
+#endif
+    return size;
 }
 
 template <EnumMetaMap E>
-template <Pointer T>
-T DB<E>::Get(E::enum_type e)
+void DBInstance<E>::read_fixed(E::enum_type e, void *dst, size_t size)
 {
-    SHOOBY_ASSERT(s_is_initialized, "DB not initialized!");
-    SHOOBY_DEBUG_PRINT("GET %s\n", get_name(e));
-    Lock lock(s_mutex);
+    if (is_atomic(e))
+    {
+        atomic_load_bytes(dst, entry_data(e), size);
+        return;
+    }
+
+#if SHOOBY_SEQLOCK_READS
+    const SeqLock &seqlock = get_stripe(e).seqlock;
+    uint32_t seq;
+    do
+    {
+        seq = seqlock.ReadBegin();
+        memcpy(dst, entry_data(e), size);
+    } while (seqlock.ReadRetry(seq));
+#else
+    EntrySharedLock lock(*this, GET, e);
+    memcpy(dst, entry_data(e), size);
+#endif
+}
+
+template <EnumMetaMap E>
+void DBInstance<E>::write_entry(E::enum_type e, const void *src, size_t size)
+{
+    // lock free readers of atomic entries don't use the seqlock
+    if (is_atomic(e))
+    {
+        atomic_store_bytes(entry_data(e), src, size);
+        return;
+    }
+
+#if SHOOBY_SEQLOCK_READS
+    SeqLock &seqlock = get_stripe(e).seqlock;
+    seqlock.WriteBegin();
+    store_value(e, entry_data(e), src, size);
+    seqlock.WriteEnd();
+#else
+    store_value(e, entry_data(e), src, size);
+#endif
+}
+
+template <EnumMetaMap E>
+value_variant_t DBInstance<E>::make_value(E::enum_type e, const void *data)
+{
+    return std::visit(Overload{
+                          [data](const char *t)
+                          { return value_variant_t((const char *)data); },
+                          [data](const void *t)
+                          { return value_variant_t(data); },
+                          [data](auto t)
+                          { return value_variant_t(*(decltype(t) *)data); },
+                      },
+                      E::META_MAP[e].default_val);
+}
 
+template <EnumMetaMap E>
+template <class T>
+bool DBInstance<E>::check_get_type(E::enum_type e)
+{
     // case for strings
-    if constexpr (std::is_same_v<T, const char *>)
+    if constexpr (std::is_same_v<T, const char *> || std::is_same_v<T, std::string_view>)
     {
         if (not std::holds_alternative<const char *>(E::META_MAP[e].default_val))
+        {
             ON_SHOOBY_TYPE_MISMATCH("type mismatch! not a string");
-
-        return (T)(DATA_BUFFER + get_offset(e));
+            return false;
+        }
     }
 
     // case for const pointers
-    else
+    else if constexpr (std::is_pointer_v<T>)
     {
         // Do not return non const pointers to the buffer,user might use it incorrectly!
         static_assert(std::is_const_v<std::remove_pointer_t<T>>, "can't provide pointer to nonconst buffer area!");
 
         if (not std::holds_alternative<const void *>(E::META_MAP[e].default_val))
+        {
             ON_SHOOBY_TYPE_MISMATCH("type mismatch! not a blob pointer");
+            return false;
+        }
+    }
 
-        return (T)(DATA_BUFFER + get_offset(e));
+    // case for blobs
+    else if constexpr (not std::is_arithmetic_v<T>)
+    {
+        if (not std::holds_alternative<const void *>(E::META_MAP[e].default_val))
+        {
+            ON_SHOOBY_TYPE_MISMATCH("type mismatch! not a blob");
+            return false;
+        }
+
+        if (sizeof(T) != get_size(e))
+        {
+            ON_SHOOBY_TYPE_MISMATCH("blob size mismatch!");
+            return false;
+        }
+    }
+
+    // case for arithmetics
+    else
+    {
+        if (not std::holds_alternative<T>(E::META_MAP[e].default_val))
+        {
+            ON_SHOOBY_TYPE_MISMATCH("type mismatch! not an arithmetic type");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+template <EnumMetaMap E>
+template <NotPointer T>
+T DBInstance<E>::Get(E::enum_type e)
+{
+    SHOOBY_ASSERT(m_is_initialized, "DB not initialized!");
+    check_get_type<T>(e);
+    count_stat(e, &KeyStats::gets);
+
+    if constexpr (std::is_same_v<T, std::string_view>)
+    {
+        EntrySharedLock lock(*this, GET, e);
+        return std::string_view((const char *)entry_data(e), string_length(entry_data(e)));
+    }
+    else
+    {
+        T t;
+        read_entry(e, &t);
+        return t;
     }
 }
 
+template <EnumMetaMap E>
+template <Pointer T>
+T DBInstance<E>::Get(E::enum_type e)
+{
+    SHOOBY_ASSERT(m_is_initialized, "DB not initialized!");
+    SHOOBY_DEBUG_PRINT("GET %s\n", get_name(e));
+    check_get_type<T>(e);
+    count_stat(e, &KeyStats::gets);
+
+    EntrySharedLock lock(*this, GET, e);
+    return (T)(entry_data(e));
+}
+
 template <EnumMetaMap E>
 template <E::enum_type e>
-FixedString<E::META_MAP[e].size> DB<E>::GetString()
+FixedString<E::META_MAP[e].size> DBInstance<E>::GetString()
+{
+    SHOOBY_ASSERT(m_is_initialized, "DB not initialized!");
+    check_get_type<const char *>(e);
+    count_stat(e, &KeyStats::gets);
+
+    char str[E::META_MAP[e].size];
+    size_t size = read_entry(e, str);
+    return FixedString<E::META_MAP[e].size>{str, size - 1};
+}
+
+template <EnumMetaMap E>
+bool DBInstance<E>::in_range(E::enum_type e, const void *data)
 {
-    SHOOBY_ASSERT(s_is_initialized, "DB not initialized!");
-    Lock lock(s_mutex);
+    if (std::holds_alternative<const char *>(E::META_MAP[e].default_val) ||
+        std::holds_alternative<const void *>(E::META_MAP[e].default_val))
+        return true;
 
-    if (not std::holds_alternative<const char *>(E::META_MAP[e].default_val))
-        ON_SHOOBY_TYPE_MISMATCH("type mismatch! not a string");
+    // the value may be unaligned, it is copied before it is read
+    alignas(std::max_align_t) uint8_t entry_copy[max_data_entry_size];
+    memcpy(entry_copy, data, get_size(e));
 
-    return FixedString<E::META_MAP[e].size>{(const char *)(DATA_BUFFER + get_offset(e))};
+    return std::visit(Overload{
+                          [](const char *t)
+                          { return true; },
+                          [](const void *t)
+                          { return true; },
+                          [e](auto t)
+                          {
+                              size_t size;
+                              return validate(e, t, size);
+                          },
+                      },
+                      make_value(e, entry_copy));
 }
 
 template <EnumMetaMap E>
 template <class T>
-bool DB<E>::Set(E::enum_type e, const T &t)
+bool DBInstance<E>::validate(E::enum_type e, const T &t, size_t &size)
 {
     using raw_type = std::decay_t<T>;
-    SHOOBY_ASSERT(s_is_initialized, "DB not initialized!");
-    size_t size = get_size(e);
-    SHOOBY_DEBUG_PRINT("SET %s\n", get_name(e));
+    size = get_size(e);
 
     if constexpr (std::is_pointer_v<raw_type>)
     {
@@ -152,10 +479,11 @@ bool DB<E>::Set(E::enum_type e, const T &t)
             if (not std::holds_alternative<const char *>(E::META_MAP[e].default_val))
                 ON_SHOOBY_TYPE_MISMATCH("type mismatch! not a string");
 
-            if (strlen(t) >= size)
+            size_t length = strlen(t);
+            if (length >= size)
                 ON_SHOOBY_TYPE_MISMATCH("string too long!");
 
-            size = strlen(t) + 1;
+            size = length + 1;
         }
 
         // case for blob pointers
@@ -168,6 +496,18 @@ bool DB<E>::Set(E::enum_type e, const T &t)
         }
     }
 
+    // case for string views, the length is known
+    else if constexpr (std::is_same_v<raw_type, std::string_view>)
+    {
+        if (not is_string(e))
+            ON_SHOOBY_TYPE_MISMATCH("type mismatch! not a string");
+
+        if (t.size() >= size)
+            ON_SHOOBY_TYPE_MISMATCH("string too long!");
+
+        size = t.size() + 1;
+    }
+
     // case for blobs
     else if constexpr (not std::is_arithmetic_v<T>)
     {
@@ -184,128 +524,1242 @@ bool DB<E>::Set(E::enum_type e, const T &t)
         if (not std::holds_alternative<T>(E::META_MAP[e].default_val))
             ON_SHOOBY_TYPE_MISMATCH("arithmetic type mismatch!");
 
-        bool in_allowed_range = false;
-
-        if constexpr (std::is_floating_point_v<T>)
-            in_allowed_range = t >= std::bit_cast<T>(E::META_MAP[e].arithmetic_min) &&
-                               t <= std::bit_cast<T>(E::META_MAP[e].arithmetic_max);
-        else
-            in_allowed_range = t >= static_cast<T>(E::META_MAP[e].arithmetic_min) &&
-                               t <= static_cast<T>(E::META_MAP[e].arithmetic_max);
-
-        if (not in_allowed_range)
-        {
-            SHOOBY_DEBUG_PRINT("value out of allowed range!");
+        if (not in_allowed_range(e, t))
             return false;
-        }
     }
 
-    bool changed = false;
-    {
-        Lock lock(s_mutex);
-        changed = set_if_changed(DATA_BUFFER + get_offset(e), t, size);
-        if (changed && s_backend != nullptr)
-        {
-            SHOOBY_DEBUG_PRINT("writing one value to backend...\n");
-            s_backend->Save(get_name(e), DATA_BUFFER + get_offset(e), get_size(e));
-        }
-    }
+    return true;
+}
 
-    IObserver *observer_node = s_observer;
-    while (observer_node != nullptr)
-    {
-        observer_node->OnSet(e, changed);
-        observer_node = observer_node->next;
-    }
+template <EnumMetaMap E>
+template <Arithmetic T>
+bool DBInstance<E>::in_allowed_range(E::enum_type e, T t)
+{
+    bool in_allowed_range = t >= range_min<T>(e) && t <= range_max<T>(e);
+    if (not in_allowed_range)
+        SHOOBY_DEBUG_PRINT("value out of allowed range!");
 
-    return changed;
+    return in_allowed_range;
 }
 
 template <EnumMetaMap E>
-template <class T>
-bool DB<E>::set_if_changed(void *dst, const T &src, size_t size)
+template <Arithmetic T>
+T DBInstance<E>::range_min(E::enum_type e)
 {
-    using raw_type = std::decay_t<T>;
-    if constexpr (std::is_pointer_v<raw_type>)
-    {
-        if (memcmp(dst, static_cast<const void *>(src), size) == 0)
-            return false;
-
-        memcpy(dst, src, size);
-        return true;
-    }
+    if constexpr (std::is_floating_point_v<T>)
+        return std::bit_cast<T>(E::META_MAP[e].arithmetic_min);
     else
-    {
-        if (memcmp(dst, &src, size) == 0)
-            return false;
+        return static_cast<T>(E::META_MAP[e].arithmetic_min);
+}
 
-        memcpy(dst, &src, size);
-        return true;
-    }
+template <EnumMetaMap E>
+template <Arithmetic T>
+T DBInstance<E>::range_max(E::enum_type e)
+{
+    if constexpr (std::is_floating_point_v<T>)
+        return std::bit_cast<T>(E::META_MAP[e].arithmetic_max);
+    else
+        return static_cast<T>(E::META_MAP[e].arithmetic_max);
 }
 
 template <EnumMetaMap E>
-template <class Visitor>
-void DB<E>::VisitRawEach(Visitor &visitor)
+template <E::enum_type K>
+auto DBInstance<E>::Get()
 {
-    SHOOBY_ASSERT(s_is_initialized, "DB not initialized!");
-    for (size_t i = 0; i < E::NUM; ++i)
+    using T = value_t<K>;
+    static_assert(not std::is_same_v<T, const void *>, "blob type unknown, define the META_MAP with DEFINE_SHOOBY_META_MAP or use Get<T>(e)");
+    SHOOBY_ASSERT(m_is_initialized, "DB not initialized!");
+
+    if constexpr (std::is_same_v<T, const char *>)
+        return GetString<K>();
+    else
     {
-        typename E::enum_type e = static_cast<E::enum_type>(i);
-        VisitRaw(e, visitor);
+        static_assert(sizeof(T) == E::META_MAP[K].size, "META_MAP size doesn't match the key type");
+        count_stat(K, &KeyStats::gets);
+        T t;
+        read_fixed(K, &t, sizeof(T));
+        return t;
     }
 }
 
 template <EnumMetaMap E>
-template <class Visitor>
-void DB<E>::VisitRaw(E::enum_type e, Visitor &visitor)
+template <E::enum_type K, class V>
+bool DBInstance<E>::Set(const V &v)
+    requires settable_as<K, V>
 {
-    SHOOBY_ASSERT(s_is_initialized, "DB not initialized!");
-    Lock lock(s_mutex);
-    visitor(e, E::META_MAP[e], DATA_BUFFER + get_offset(e));
+    using T = value_t<K>;
+    static_assert(not std::is_same_v<T, const void *>, "blob type unknown, define the META_MAP with DEFINE_SHOOBY_META_MAP or use Set(e, t)");
+    SHOOBY_ASSERT(m_is_initialized, "DB not initialized!");
+
+    size_t size = E::META_MAP[K].size;
+    if constexpr (std::is_same_v<T, const char *>)
+    {
+        std::string_view t(v);
+        if (t.size() >= size)
+            ON_SHOOBY_TYPE_MISMATCH("string too long!");
+
+        size = t.size() + 1;
+        return apply(K, t, size);
+    }
+    else
+    {
+        static_assert(sizeof(T) == E::META_MAP[K].size, "META_MAP size doesn't match the key type");
+        if constexpr (std::is_arithmetic_v<T>)
+            if (not in_allowed_range(K, v))
+                return false;
+
+        return apply(K, v, size);
+    }
 }
 
 template <EnumMetaMap E>
-template <class Visitor>
-void DB<E>::Visit(E::enum_type e, Visitor &visitor)
+template <class T>
+bool DBInstance<E>::Set(E::enum_type e, const T &t)
 {
-    SHOOBY_ASSERT(s_is_initialized, "DB not initialized!");
-    Lock lock(s_mutex);
-
-    size_t offset = get_offset(e);
-    const void *dst = DATA_BUFFER + offset;
+    SHOOBY_ASSERT(m_is_initialized, "DB not initialized!");
+    SHOOBY_DEBUG_PRINT("SET %s\n", get_name(e));
 
-    value_variant_t val = std::visit(Overload{
-                                         [dst](const char *t)
-                                         { return value_variant_t((const char *)dst); },
-                                         [dst](const void *t)
-                                         { return value_variant_t(dst); },
-                                         [dst](auto t)
-                                         { return value_variant_t(*(decltype(t) *)dst); },
-                                     },
-                                     E::META_MAP[e].default_val);
+    size_t size;
+    if (not validate(e, t, size))
+        return false;
 
-    visitor(e, val);
+    return apply(e, t, size);
 }
 
 template <EnumMetaMap E>
-template <class Visitor>
-void DB<E>::VisitEach(Visitor &visitor)
+template <class T>
+bool DBInstance<E>::apply(E::enum_type e, const T &t, size_t size)
 {
+    count_stat(e, &KeyStats::sets);
 
-    SHOOBY_ASSERT(s_is_initialized, "DB not initialized!");
-    for (size_t i = 0; i < E::NUM; ++i)
+#if SHOOBY_ATOMIC_ARITHMETIC
+    // an unchanged atomic entry has nothing to stamp or persist, it returns without locking
+    if (is_atomic(e))
     {
-        typename E::enum_type e = static_cast<E::enum_type>(i);
-        Visit(e, visitor);
+        alignas(uint32_t) uint8_t current[sizeof(uint32_t)];
+        atomic_load_bytes(current, entry_data(e), size);
+        if (memcmp(current, source_of(t), size) == 0)
+        {
+            notify(e, false);
+            return false;
+        }
+    }
+#endif
+
+    bool changed = false;
+    {
+        uint64_t start = stats_now();
+        EntryLock lock(*this, SET, e);
+        record_latency(e, &KeyStats::lock_wait, start);
+
+        start = stats_now();
+        changed = set_if_changed(e, t, size);
+        record_latency(e, &KeyStats::set_if_changed, start);
+        if (changed)
+            persist(e);
+    }
+
+    if (changed)
+    {
+        count_stat(e, &KeyStats::changed);
+        auto_flush();
     }
+
+    notify(e, changed);
+    return changed;
 }
 
 template <EnumMetaMap E>
-void DB<E>::SetObserver(DB<E>::IObserver *observer)
+template <class T, class Fn>
+bool DBInstance<E>::Update(E::enum_type e, Fn &&fn)
 {
-    SHOOBY_ASSERT(s_is_initialized, "DB not initialized!");
-    Lock lock(s_mutex);
-    observer->next = s_observer;
-    s_observer = observer;
-}
\ No newline at end of file
+    SHOOBY_ASSERT(m_is_initialized, "DB not initialized!");
+
+    return modify<T>(e, [&fn](T &value)
+                     {
+                         fn(value);
+                         return true; });
+}
+
+template <EnumMetaMap E>
+template <class T>
+bool DBInstance<E>::CompareExchange(E::enum_type e, T &expected, const T &desired)
+{
+    SHOOBY_ASSERT(m_is_initialized, "DB not initialized!");
+    if (not check_get_type<T>(e))
+        return false;
+
+    if constexpr (std::is_arithmetic_v<T>)
+        if (not in_allowed_range(e, desired))
+            return false;
+
+    bool exchanged = false;
+    modify<T>(e, [&](T &value)
+              {
+                  exchanged = memcmp(&value, &expected, sizeof(T)) == 0;
+                  if (exchanged)
+                      value = desired;
+                  else
+                      expected = value;
+
+                  return exchanged; });
+
+    return exchanged;
+}
+
+template <EnumMetaMap E>
+template <Arithmetic T>
+T DBInstance<E>::FetchAdd(E::enum_type e, std::type_identity_t<T> delta)
+{
+    return fetch_add<T>(e, static_cast<double>(delta));
+}
+
+template <EnumMetaMap E>
+template <Arithmetic T>
+T DBInstance<E>::FetchSub(E::enum_type e, std::type_identity_t<T> delta)
+{
+    return fetch_add<T>(e, -static_cast<double>(delta));
+}
+
+template <EnumMetaMap E>
+template <Arithmetic T>
+T DBInstance<E>::fetch_add(E::enum_type e, double delta)
+{
+    static_assert(not std::is_same_v<T, bool>, "can't add to a bool");
+    SHOOBY_ASSERT(m_is_initialized, "DB not initialized!");
+
+    // every value_variant_t arithmetic type is exact in a double, so the sum can't wrap before clamping
+    T previous{};
+    modify<T>(e, [&](T &value)
+              {
+                  previous = value;
+                  double sum = static_cast<double>(value) + delta;
+                  if (sum < static_cast<double>(range_min<T>(e)))
+                      value = range_min<T>(e);
+                  else if (sum > static_cast<double>(range_max<T>(e)))
+                      value = range_max<T>(e);
+                  else
+                      value = static_cast<T>(sum);
+
+                  return true; });
+
+    return previous;
+}
+
+template <EnumMetaMap E>
+template <class T, class Fn>
+bool DBInstance<E>::modify(E::enum_type e, Fn &&fn)
+{
+    static_assert(not std::is_pointer_v<T> && not std::is_same_v<T, std::string_view>, "strings can't be modified in place, use Set");
+
+    // a T of another size would be copied over the neighbouring entries
+    if (not check_get_type<T>(e))
+        return false;
+
+    count_stat(e, &KeyStats::sets);
+
+    bool written = false;
+    bool changed = false;
+    {
+        uint64_t start = stats_now();
+        EntryLock lock(*this, SET, e);
+        record_latency(e, &KeyStats::lock_wait, start);
+
+        T value;
+        memcpy(&value, entry_data(e), sizeof(T));
+        written = fn(value);
+        if (written && not in_range(e, &value))
+        {
+            SHOOBY_DEBUG_PRINT("value out of allowed range! dropping\n");
+            written = false;
+        }
+
+        if (written)
+        {
+            start = stats_now();
+            changed = set_if_changed(e, value, sizeof(T));
+            record_latency(e, &KeyStats::set_if_changed, start);
+            if (changed)
+                persist(e);
+        }
+    }
+
+    if (changed)
+    {
+        count_stat(e, &KeyStats::changed);
+        auto_flush();
+    }
+
+    if (written)
+        notify(e, changed);
+
+    return changed;
+}
+
+template <EnumMetaMap E>
+template <class Source>
+typename DBInstance<E>::KeySet DBInstance<E>::apply_batch(const KeySet &keys, Source &&source)
+{
+    KeySet changed{};
+    {
+        DBLock lock(*this, BATCH);
+
+        size_t changed_count = 0;
+        for (size_t i = 0; i < E::NUM; i++)
+        {
+            if (not keys.test(i))
+                continue;
+
+            typename E::enum_type e = static_cast<E::enum_type>(i);
+            const void *src = source(e);
+            count_stat(e, &KeyStats::sets);
+
+            uint64_t start = stats_now();
+            bool entry_changed = set_if_changed(e, src, value_size(e, src));
+            record_latency(e, &KeyStats::set_if_changed, start);
+            if (entry_changed)
+            {
+                count_stat(e, &KeyStats::changed);
+                changed.set(i);
+                m_batch[changed_count++] = {get_name(e), entry_data(e), get_size(e)};
+            }
+        }
+
+        if (changed_count > 0)
+            persist_batch(changed, changed_count);
+    }
+
+    if (changed.any())
+        auto_flush();
+
+    notify_many(keys, changed);
+    return changed;
+}
+
+template <EnumMetaMap E>
+void DBInstance<E>::persist(E::enum_type e)
+{
+    uint64_t start = stats_now();
+#if SHOOBY_MMAP_BUFFER
+    if (m_image.Mapped())
+    {
+        size_t prefix = entry_prefix_size<E>(e);
+        m_image.Sync(get_offset(e) - prefix, prefix + get_size(e));
+        record_latency(e, &KeyStats::backend_save, start);
+        return;
+    }
+#endif
+
+    if (m_backend == nullptr)
+        return;
+
+#if SHOOBY_WRITE_BEHIND
+    if (m_write_behind.dirty.Set(e))
+        m_write_behind.coalesced_writes.fetch_add(1, std::memory_order_relaxed);
+
+    // wake the flusher only on the first dirty entry since its last flush
+    else if (not m_write_behind.pending.exchange(true))
+    {
+        std::lock_guard lock(m_write_behind.wake_mutex);
+        m_write_behind.wake.notify_one();
+    }
+#elif SHOOBY_DEFERRED_PERSIST
+    m_dirty.Set(e);
+#else
+    SHOOBY_DEBUG_PRINT("writing one value to backend...\n");
+    save_image(get_offset(e), entry_data(e), get_size(e));
+    m_backend->Save(get_name(e), entry_data(e), get_size(e));
+#endif
+    record_latency(e, &KeyStats::backend_save, start);
+}
+
+template <EnumMetaMap E>
+void DBInstance<E>::persist_batch(const KeySet &changed, size_t count)
+{
+    // mapped buffer syncs page by page, write behind and deferred persistence mark keys dirty: all are per key
+    bool per_key = SHOOBY_WRITE_BEHIND || SHOOBY_DEFERRED_PERSIST;
+#if SHOOBY_MMAP_BUFFER
+    per_key = per_key || m_image.Mapped();
+#endif
+
+    if (per_key)
+    {
+        for (size_t i = 0; i < E::NUM; i++)
+            if (changed.test(i))
+                persist(static_cast<E::enum_type>(i));
+        return;
+    }
+
+    if (m_backend == nullptr)
+        return;
+
+    save_batch(count);
+}
+
+template <EnumMetaMap E>
+void DBInstance<E>::save_batch(size_t count)
+{
+    // one image write from the first to the last changed entry, m_batch is in key (and offset) order
+    const uint8_t *first = static_cast<const uint8_t *>(m_batch[0].data);
+    const uint8_t *end = static_cast<const uint8_t *>(m_batch[count - 1].data) + m_batch[count - 1].size;
+    save_image(first - buffer(), first, end - first);
+
+    SHOOBY_DEBUG_PRINT("writing %zu values to backend...\n", count);
+    m_backend->SaveBatch(std::span<const BackendEntry>(m_batch, count));
+}
+
+#if SHOOBY_DEFERRED_PERSIST
+template <EnumMetaMap E>
+void DBInstance<E>::Flush()
+{
+    SHOOBY_ASSERT(m_is_initialized, "DB not initialized!");
+    if (m_dirty.Count() == 0)
+        return;
+
+    // a writer blocked here marks its key dirty after the flush, it is saved by the next one
+    DBLock lock(*this, FLUSH);
+    if (m_backend == nullptr)
+        return;
+    size_t count = 0;
+    for (size_t i = 0; i < E::NUM; i++)
+    {
+        if (not m_dirty.Reset(i))
+            continue;
+
+        typename E::enum_type e = static_cast<E::enum_type>(i);
+        m_batch[count++] = {get_name(e), entry_data(e), get_size(e)};
+    }
+
+    if (count > 0)
+        save_batch(count);
+}
+#endif
+
+#if SHOOBY_WRITE_BEHIND
+template <EnumMetaMap E>
+void DBInstance<E>::Flush()
+{
+    SHOOBY_ASSERT(m_is_initialized, "DB not initialized!");
+    WriteBehind &wb = m_write_behind;
+    std::lock_guard flush_lock(wb.flush_mutex);
+    if (m_backend == nullptr)
+        return;
+    auto start = std::chrono::steady_clock::now();
+    wb.pending.store(false);
+
+    // copy dirty entries out under their stripe lock, then save without holding any DB lock
+    size_t count = 0;
+    for (size_t i = 0; i < E::NUM; i++)
+    {
+        if (not wb.dirty.Reset(i))
+            continue;
+
+        typename E::enum_type e = static_cast<E::enum_type>(i);
+        {
+            EntrySharedLock lock(*this, FLUSH, e);
+            memcpy(wb.buffer + get_offset(e), entry_data(e), get_size(e));
+        }
+
+        wb.entries[count++] = {get_name(e), wb.buffer + get_offset(e), get_size(e)};
+    }
+
+    if (count == 0)
+        return;
+
+    // the flush buffer is only current for the dirty entries, image regions are saved one by one
+    for (size_t i = 0; i < count; i++)
+    {
+        const uint8_t *data = static_cast<const uint8_t *>(wb.entries[i].data);
+        save_image(data - wb.buffer, data, wb.entries[i].size);
+    }
+
+    SHOOBY_DEBUG_PRINT("flushing %zu values to backend...\n", count);
+    m_backend->SaveBatch(std::span<const BackendEntry>(wb.entries, count));
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    uint32_t flush_us = static_cast<uint32_t>(elapsed.count());
+    wb.flushes.fetch_add(1, std::memory_order_relaxed);
+    wb.saved_entries.fetch_add(count, std::memory_order_relaxed);
+    wb.last_flush_us.store(flush_us, std::memory_order_relaxed);
+    if (flush_us > wb.max_flush_us.load(std::memory_order_relaxed))
+        wb.max_flush_us.store(flush_us, std::memory_order_relaxed);
+}
+
+template <EnumMetaMap E>
+typename DBInstance<E>::WriteBehindStats DBInstance<E>::GetWriteBehindStats()
+{
+    const WriteBehind &wb = m_write_behind;
+    return WriteBehindStats{
+        .queue_depth = wb.dirty.Count(),
+        .flushes = wb.flushes.load(std::memory_order_relaxed),
+        .saved_entries = wb.saved_entries.load(std::memory_order_relaxed),
+        .coalesced_writes = wb.coalesced_writes.load(std::memory_order_relaxed),
+        .last_flush_us = wb.last_flush_us.load(std::memory_order_relaxed),
+        .max_flush_us = wb.max_flush_us.load(std::memory_order_relaxed),
+    };
+}
+
+template <EnumMetaMap E>
+void DBInstance<E>::flusher_main()
+{
+    WriteBehind &wb = m_write_behind;
+    std::unique_lock lock(wb.wake_mutex);
+    while (true)
+    {
+        wb.wake.wait(lock, [&wb]
+                     { return wb.stop || wb.pending.load(); });
+        if (wb.stop)
+            break;
+
+        // let more writes pile up so repeated writes to the same key are saved once
+        wb.wake.wait_for(lock, std::chrono::milliseconds(SHOOBY_WRITE_BEHIND_PERIOD_MS), [&wb]
+                         { return wb.stop; });
+
+        lock.unlock();
+        Flush();
+        lock.lock();
+    }
+}
+#endif
+
+#if SHOOBY_WRITE_BEHIND || SHOOBY_ASYNC_OBSERVERS
+template <EnumMetaMap E>
+void DBInstance<E>::Shutdown()
+{
+    stop_threads();
+
+#if SHOOBY_ASYNC_OBSERVERS
+    deliver_pending();
+#endif
+}
+
+template <EnumMetaMap E>
+void DBInstance<E>::stop_threads()
+{
+#if SHOOBY_WRITE_BEHIND
+    WriteBehind &wb = m_write_behind;
+    if (wb.thread.joinable())
+    {
+        {
+            std::lock_guard lock(wb.wake_mutex);
+            wb.stop = true;
+        }
+        wb.wake.notify_one();
+        wb.thread.join();
+    }
+
+    // nothing dirty is lost when the DB is destroyed without Shutdown
+    if (m_is_initialized)
+        Flush();
+#endif
+
+#if SHOOBY_ASYNC_OBSERVERS
+    Notifier &n = m_notifier;
+    if (n.thread.joinable())
+    {
+        n.stop.store(true);
+        n.Wake();
+        n.thread.join();
+        n.running.store(false, std::memory_order_release);
+
+        // events pushed after the last drain of the thread, wakes FlushObservers waiting for them
+        deliver_pending();
+    }
+#endif
+}
+#endif
+
+#if SHOOBY_ASYNC_OBSERVERS
+template <EnumMetaMap E>
+void DBInstance<E>::start_notifier()
+{
+    if (m_notifier.thread.joinable())
+        return;
+
+    m_notifier.stop.store(false);
+    m_notifier.thread = std::thread(&DBInstance::notifier_main, this);
+    m_notifier.running.store(true, std::memory_order_release);
+}
+
+template <EnumMetaMap E>
+void DBInstance<E>::post(E::enum_type e, bool changed)
+{
+    Notifier &n = m_notifier;
+    observer_mask_t subscribers = m_subscribers[e].load(std::memory_order_acquire);
+    if (subscribers == 0)
+        return;
+
+    // the subscribers are taken at post time, observers registered later don't get older events
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    Event event{static_cast<uint32_t>(e), changed, subscribers, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count())};
+    n.posted.fetch_add(1, std::memory_order_relaxed);
+
+#if SHOOBY_ASYNC_OVERFLOW == SHOOBY_ASYNC_OVERFLOW_DROP_OLDEST
+    while (not n.queue.TryPush(event))
+    {
+        Event oldest;
+        if (n.queue.TryPop(oldest))
+        {
+            n.dropped.fetch_add(1, std::memory_order_relaxed);
+            n.Complete(1);
+        }
+    }
+#else
+    if (not n.queue.TryPush(event))
+    {
+        // changed bit and subscribers first, so the notifier never sees the key without them
+        if (changed)
+            n.overflow_changed.Set(e);
+        n.overflow_subscribers[e].fetch_or(subscribers, std::memory_order_relaxed);
+
+        if (n.overflow.Set(e))
+        {
+            n.coalesced.fetch_add(1, std::memory_order_relaxed);
+            n.Complete(1);
+        }
+        else
+            n.has_overflow.store(true, std::memory_order_release);
+    }
+#endif
+
+    atomic_store_max(n.max_queue_depth, n.queue.Size());
+
+    n.Wake();
+}
+
+// delivers queued events then coalesced ones on the calling thread, returns the number delivered
+template <EnumMetaMap E>
+size_t DBInstance<E>::deliver_pending()
+{
+    Notifier &n = m_notifier;
+    size_t count = 0;
+
+    Event event;
+    while (n.queue.TryPop(event))
+    {
+        dispatch(static_cast<E::enum_type>(event.key), event.changed, event.subscribers);
+
+        auto now = std::chrono::steady_clock::now().time_since_epoch();
+        uint64_t now_ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
+        uint32_t lag_us = static_cast<uint32_t>((now_ns - event.posted_ns) / 1000);
+        n.last_lag_us.store(lag_us, std::memory_order_relaxed);
+        atomic_store_max(n.max_lag_us, lag_us);
+
+        n.Complete(1);
+        count++;
+    }
+
+    if (n.has_overflow.exchange(false, std::memory_order_acquire))
+    {
+        for (size_t i = 0; i < E::NUM; i++)
+        {
+            if (not n.overflow.Reset(i))
+                continue;
+
+            bool changed = n.overflow_changed.Reset(i);
+            observer_mask_t subscribers = n.overflow_subscribers[i].exchange(0, std::memory_order_relaxed);
+            dispatch(static_cast<E::enum_type>(i), changed, subscribers);
+            n.Complete(1);
+            count++;
+        }
+    }
+
+    n.delivered.fetch_add(count, std::memory_order_relaxed);
+    return count;
+}
+
+template <EnumMetaMap E>
+void DBInstance<E>::notifier_main()
+{
+    Notifier &n = m_notifier;
+    while (true)
+    {
+        // read the signal before draining, a post after the drain changes it and wait returns at once
+        uint32_t seen = n.signal.load(std::memory_order_acquire);
+        deliver_pending();
+
+        if (n.stop.load())
+            break;
+
+        n.signal.wait(seen, std::memory_order_acquire);
+    }
+
+    deliver_pending();
+}
+
+template <EnumMetaMap E>
+void DBInstance<E>::FlushObservers()
+{
+    Notifier &n = m_notifier;
+    size_t target = n.posted.load(std::memory_order_acquire);
+    size_t completed = n.completed.load(std::memory_order_acquire);
+    while (completed < target)
+    {
+        // no notifier thread to wait for, before Init or after Shutdown
+        if (not n.running.load(std::memory_order_acquire))
+        {
+            deliver_pending();
+            return;
+        }
+
+        n.completed.wait(completed, std::memory_order_acquire);
+        completed = n.completed.load(std::memory_order_acquire);
+    }
+}
+
+template <EnumMetaMap E>
+typename DBInstance<E>::NotifierStats DBInstance<E>::GetNotifierStats()
+{
+    const Notifier &n = m_notifier;
+    return NotifierStats{
+        .queue_depth = n.queue.Size(),
+        .max_queue_depth = n.max_queue_depth.load(std::memory_order_relaxed),
+        .delivered = n.delivered.load(std::memory_order_relaxed),
+        .dropped = n.dropped.load(std::memory_order_relaxed),
+        .coalesced = n.coalesced.load(std::memory_order_relaxed),
+        .last_lag_us = n.last_lag_us.load(std::memory_order_relaxed),
+        .max_lag_us = n.max_lag_us.load(std::memory_order_relaxed),
+    };
+}
+#endif
+
+template <EnumMetaMap E>
+void DBInstance<E>::notify(E::enum_type e, bool changed)
+{
+#if SHOOBY_ASYNC_OBSERVERS
+    post(e, changed);
+#else
+    dispatch(e, changed, m_subscribers[e].load(std::memory_order_acquire));
+#endif
+}
+
+template <EnumMetaMap E>
+void DBInstance<E>::dispatch(E::enum_type e, bool changed, observer_mask_t mask)
+{
+    if (mask == 0)
+        return;
+
+    // latest registered observer is called first
+    uint64_t start = stats_now();
+    while (mask != 0)
+    {
+        int i = std::bit_width(mask) - 1;
+        m_observers[i]->OnSet(e, changed);
+        mask &= ~(observer_mask_t(1) << i);
+    }
+
+    record_latency(e, &KeyStats::observer_dispatch, start);
+}
+
+template <EnumMetaMap E>
+void DBInstance<E>::notify_many(const KeySet &keys, const KeySet &changed)
+{
+#if SHOOBY_ASYNC_OBSERVERS
+    for (size_t i = 0; i < E::NUM; i++)
+        if (keys.test(i))
+            post(static_cast<E::enum_type>(i), changed.test(i));
+#else
+    size_t count = m_observer_count.load(std::memory_order_acquire);
+    for (size_t i = count; i > 0; i--)
+    {
+        const KeySet &subscribed = m_observer_keys[i - 1];
+        KeySet observed = keys & subscribed;
+        if (observed.any())
+            m_observers[i - 1]->OnSetMany(observed, changed & subscribed);
+    }
+#endif
+}
+
+template <EnumMetaMap E>
+template <class T>
+bool DBInstance<E>::Transaction::Set(E::enum_type e, const T &t)
+{
+    size_t size;
+    if (not DBInstance::validate(e, t, size))
+        return false;
+
+    DBInstance::store_value(e, data + DBInstance::get_offset(e), DBInstance::source_of(t), size);
+    staged.set(e);
+    return true;
+}
+
+template <EnumMetaMap E>
+typename DBInstance<E>::KeySet DBInstance<E>::Transaction::Commit()
+{
+    SHOOBY_ASSERT(db.m_is_initialized, "DB not initialized!");
+    KeySet changed = db.apply_batch(staged, [this](E::enum_type e)
+                                    { return data + DBInstance::get_offset(e); });
+    staged.reset();
+    return changed;
+}
+
+template <EnumMetaMap E>
+template <class T>
+bool DBInstance<E>::set_if_changed(E::enum_type e, const T &src, size_t size)
+{
+    const void *src_ptr = source_of(src);
+
+    // strings compare lengths first, then only their live chars
+    if (is_string(e))
+    {
+        if (string_length(entry_data(e)) == size - 1 && memcmp(entry_data(e), src_ptr, size - 1) == 0)
+            return false;
+    }
+    else if (memcmp(entry_data(e), src_ptr, size) == 0)
+        return false;
+
+    write_entry(e, src_ptr, size);
+    mark_modified(e);
+    return true;
+}
+
+template <EnumMetaMap E>
+void DBInstance<E>::mark_modified(E::enum_type e)
+{
+    m_modified[e].store(m_epoch.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+template <EnumMetaMap E>
+template <class Visitor>
+void DBInstance<E>::VisitRawEach(Visitor &visitor)
+{
+    SHOOBY_ASSERT(m_is_initialized, "DB not initialized!");
+    DBSharedLock lock(*this, VISIT);
+    for (size_t i = 0; i < E::NUM; ++i)
+    {
+        typename E::enum_type e = static_cast<E::enum_type>(i);
+        visitor(e, E::META_MAP[e], static_cast<const uint8_t *>(entry_data(e)));
+    }
+}
+
+template <EnumMetaMap E>
+template <class Visitor>
+void DBInstance<E>::VisitRaw(E::enum_type e, Visitor &visitor)
+{
+    SHOOBY_ASSERT(m_is_initialized, "DB not initialized!");
+    EntrySharedLock lock(*this, VISIT, e);
+    visitor(e, E::META_MAP[e], static_cast<const uint8_t *>(entry_data(e)));
+}
+
+template <EnumMetaMap E>
+template <class Visitor>
+void DBInstance<E>::Visit(E::enum_type e, Visitor &visitor)
+{
+    SHOOBY_ASSERT(m_is_initialized, "DB not initialized!");
+
+    // the visitor gets a copy, so it is called without holding the lock
+    alignas(std::max_align_t) uint8_t entry_copy[max_data_entry_size];
+    read_entry(e, entry_copy);
+
+    value_variant_t val = make_value(e, entry_copy);
+    visitor(e, val);
+}
+
+template <EnumMetaMap E>
+template <class Visitor>
+void DBInstance<E>::VisitEach(Visitor &visitor)
+{
+    SHOOBY_ASSERT(m_is_initialized, "DB not initialized!");
+
+    // one lock round trip for the whole traversal, every entry is seen at the same point in time
+    DBSharedLock lock(*this, VISIT);
+    for (size_t i = 0; i < E::NUM; ++i)
+    {
+        typename E::enum_type e = static_cast<E::enum_type>(i);
+        value_variant_t val = make_value(e, entry_data(e));
+        visitor(e, val);
+    }
+}
+
+template <EnumMetaMap E>
+uint32_t DBInstance<E>::CurrentEpoch()
+{
+    return m_epoch.load(std::memory_order_relaxed);
+}
+
+template <EnumMetaMap E>
+template <class Visitor>
+uint32_t DBInstance<E>::ChangedSince(uint32_t epoch, Visitor &visitor)
+{
+    SHOOBY_ASSERT(m_is_initialized, "DB not initialized!");
+
+    // with all stripes locked no stamp is in flight, every epoch up to now is already stored
+    uint32_t now;
+    {
+        DBSharedLock lock(*this, VISIT);
+        now = m_epoch.load(std::memory_order_relaxed);
+    }
+
+    for (size_t i = 0; i < E::NUM; ++i)
+    {
+        // wrap around safe "modified after epoch"
+        if (static_cast<int32_t>(m_modified[i].load(std::memory_order_relaxed) - epoch) > 0)
+            Visit(static_cast<E::enum_type>(i), visitor);
+    }
+
+    return now;
+}
+
+template <EnumMetaMap E>
+bool DBInstance<E>::SetObserver(IObserver *observer, const KeySet &keys)
+{
+    SHOOBY_ASSERT(m_is_initialized, "DB not initialized!");
+    DBLock lock(*this, OBSERVER);
+
+    // the masks have a bit per observer, there is no room for another one
+    size_t index = m_observer_count.load(std::memory_order_relaxed);
+    if (index >= SHOOBY_MAX_OBSERVERS)
+    {
+        SHOOBY_DEBUG_PRINT("too many observers! increase SHOOBY_MAX_OBSERVERS\n");
+        return false;
+    }
+
+    for (size_t i = 0; i < index; i++)
+        SHOOBY_ASSERT(m_observers[i] != observer, "observer already registered!");
+
+    // the observer is fully set up before Set/Commit can see it through the masks and count
+    m_observer_keys[index] = keys;
+    m_observers[index] = observer;
+    m_observer_count.store(index + 1, std::memory_order_release);
+
+    for (size_t i = 0; i < E::NUM; i++)
+        if (keys.test(i))
+            m_subscribers[i].fetch_or(observer_mask_t(1) << index, std::memory_order_release);
+
+    return true;
+}
+
+#if SHOOBY_STATS
+template <EnumMetaMap E>
+template <class Visitor>
+void DBInstance<E>::VisitStats(Visitor &visitor)
+{
+    for (size_t i = 0; i < E::NUM; ++i)
+    {
+        typename E::enum_type e = static_cast<E::enum_type>(i);
+        const KeyStats &stats = m_stats[i];
+        EntryStats entry{
+            .gets = stats.gets.load(std::memory_order_relaxed),
+            .sets = stats.sets.load(std::memory_order_relaxed),
+            .changed = stats.changed.load(std::memory_order_relaxed),
+            .lock_wait = stats.lock_wait.Load(),
+            .set_if_changed = stats.set_if_changed.Load(),
+            .backend_save = stats.backend_save.Load(),
+            .observer_dispatch = stats.observer_dispatch.Load(),
+        };
+
+        visitor(e, E::META_MAP[e], static_cast<const EntryStats &>(entry));
+    }
+}
+
+template <EnumMetaMap E>
+void DBInstance<E>::ResetStats()
+{
+    for (KeyStats &stats : m_stats)
+    {
+        stats.gets.store(0, std::memory_order_relaxed);
+        stats.sets.store(0, std::memory_order_relaxed);
+        stats.changed.store(0, std::memory_order_relaxed);
+        stats.lock_wait.Reset();
+        stats.set_if_changed.Reset();
+        stats.backend_save.Reset();
+        stats.observer_dispatch.Reset();
+    }
+}
+#endif
+
+#if SHOOBY_LOCK_PROFILING
+template <EnumMetaMap E>
+template <class Visitor>
+void DBInstance<E>::VisitLockProfile(Visitor &visitor)
+{
+    LockSiteProfile profiles[LOCK_SITES];
+    size_t count = 0;
+    for (size_t i = 0; i < LOCK_SITES; i++)
+    {
+        LockProfile::Counts counts = m_lock_profiles[i].Load();
+        if (counts.acquisitions == 0)
+            continue;
+
+        const char *key = counts.max_hold_key < E::NUM ? get_name(static_cast<E::enum_type>(counts.max_hold_key)) : "ALL";
+        profiles[count++] = {LOCK_SITE_NAMES[i], counts, key};
+    }
+
+    // worst offenders first
+    std::sort(profiles, profiles + count, [](const LockSiteProfile &a, const LockSiteProfile &b)
+              { return a.counts.max_hold_ns > b.counts.max_hold_ns; });
+
+    for (size_t i = 0; i < count; i++)
+        visitor(static_cast<const LockSiteProfile &>(profiles[i]));
+}
+
+template <EnumMetaMap E>
+void DBInstance<E>::ResetLockProfile()
+{
+    for (LockProfile &profile : m_lock_profiles)
+        profile.Reset();
+}
+#endif
+
+template <EnumMetaMap E>
+constexpr size_t DBInstance<E>::MaxDeltaSize()
+{
+    return sizeof(DeltaHeader) + E::NUM * DELTA_RECORD_HEADER + required_data_buffer_size;
+}
+
+template <EnumMetaMap E>
+size_t DBInstance<E>::ExportDelta(std::span<uint8_t> out, const KeySet &keys)
+{
+    SHOOBY_ASSERT(m_is_initialized, "DB not initialized!");
+    if (out.size() < sizeof(DeltaHeader))
+        return 0;
+
+    size_t pos = sizeof(DeltaHeader);
+    uint16_t count = 0;
+    {
+        DBSharedLock lock(*this, SNAPSHOT);
+        for (size_t i = 0; i < E::NUM; i++)
+        {
+            if (not keys.test(i))
+                continue;
+
+            typename E::enum_type e = static_cast<E::enum_type>(i);
+            uint16_t index = static_cast<uint16_t>(i);
+            uint16_t length = static_cast<uint16_t>(live_size(e, entry_data(e)));
+            if (out.size() - pos < DELTA_RECORD_HEADER + length)
+                return 0;
+
+            memcpy(&out[pos], &index, sizeof(index));
+            memcpy(&out[pos + sizeof(index)], &length, sizeof(length));
+            memcpy(&out[pos + DELTA_RECORD_HEADER], entry_data(e), length);
+            pos += DELTA_RECORD_HEADER + length;
+            count++;
+        }
+    }
+
+    DeltaHeader header{DELTA_MAGIC, DELTA_VERSION, count, fingerprint, 0};
+    header.crc = crc32(&out[sizeof(DeltaHeader)], pos - sizeof(DeltaHeader));
+    memcpy(out.data(), &header, sizeof(header));
+    return pos;
+}
+
+template <EnumMetaMap E>
+bool DBInstance<E>::ImportDelta(std::span<const uint8_t> in)
+{
+    SHOOBY_ASSERT(m_is_initialized, "DB not initialized!");
+
+    DeltaHeader header;
+    if (in.size() < sizeof(header))
+        return false;
+
+    memcpy(&header, in.data(), sizeof(header));
+    if (header.magic != DELTA_MAGIC || header.version != DELTA_VERSION || header.fingerprint != fingerprint)
+    {
+        SHOOBY_DEBUG_PRINT("shooby_db: delta of another META_MAP\n");
+        return false;
+    }
+
+    if (crc32(in.data() + sizeof(header), in.size() - sizeof(header)) != header.crc)
+    {
+        SHOOBY_DEBUG_PRINT("shooby_db: delta crc mismatch\n");
+        return false;
+    }
+
+    // validate every record before applying anything, values are applied straight from the stream
+    KeySet keys{};
+    const uint8_t *sources[E::NUM];
+    size_t pos = sizeof(header);
+    for (uint16_t n = 0; n < header.count; n++)
+    {
+        uint16_t index, length;
+        if (in.size() - pos < DELTA_RECORD_HEADER)
+            return false;
+
+        memcpy(&index, &in[pos], sizeof(index));
+        memcpy(&length, &in[pos + sizeof(index)], sizeof(length));
+        pos += DELTA_RECORD_HEADER;
+        if (index >= E::NUM || keys.test(index) || in.size() - pos < length)
+            return false;
+
+        typename E::enum_type e = static_cast<E::enum_type>(index);
+        const uint8_t *value = &in[pos];
+        if (std::holds_alternative<const char *>(E::META_MAP[e].default_val))
+        {
+            // live bytes and exactly one NUL at the end
+            if (length == 0 || length > get_size(e) || memchr(value, '\0', length) != value + length - 1)
+                return false;
+        }
+        else if (length != get_size(e) || not in_range(e, value))
+            return false;
+
+        keys.set(index);
+        sources[index] = value;
+        pos += length;
+    }
+
+    if (pos != in.size())
+        return false;
+
+    apply_batch(keys, [&sources](E::enum_type e)
+                { return sources[e]; });
+    return true;
+}
+
+template <EnumMetaMap E>
+typename DBInstance<E>::SnapshotView DBInstance<E>::Snapshot()
+{
+    SHOOBY_ASSERT(m_is_initialized, "DB not initialized!");
+    SnapshotView snapshot;
+    {
+        DBSharedLock lock(*this, SNAPSHOT);
+        memcpy(snapshot.data, buffer(), required_data_buffer_size);
+    }
+
+    return snapshot;
+}
+
+template <EnumMetaMap E>
+template <NotPointer T>
+T DBInstance<E>::SnapshotView::Get(E::enum_type e) const
+{
+    DBInstance::check_get_type<T>(e);
+
+    if constexpr (std::is_same_v<T, std::string_view>)
+        return std::string_view((const char *)entry_data(e), DBInstance::string_length(entry_data(e)));
+    else
+    {
+        T t;
+        memcpy(&t, entry_data(e), get_size(e));
+        return t;
+    }
+}
+
+template <EnumMetaMap E>
+template <Pointer T>
+T DBInstance<E>::SnapshotView::Get(E::enum_type e) const
+{
+    DBInstance::check_get_type<T>(e);
+    return (T)(entry_data(e));
+}
+
+template <EnumMetaMap E>
+template <E::enum_type e>
+FixedString<E::META_MAP[e].size> DBInstance<E>::SnapshotView::GetString() const
+{
+    DBInstance::check_get_type<const char *>(e);
+    return FixedString<E::META_MAP[e].size>{(const char *)entry_data(e), DBInstance::string_length(entry_data(e))};
+}
+
+template <EnumMetaMap E>
+template <class Visitor>
+void DBInstance<E>::SnapshotView::Visit(E::enum_type e, Visitor &visitor) const
+{
+    value_variant_t val = DBInstance::make_value(e, entry_data(e));
+    visitor(e, val);
+}
+
+template <EnumMetaMap E>
+template <class Visitor>
+void DBInstance<E>::SnapshotView::VisitEach(Visitor &visitor) const
+{
+    for (size_t i = 0; i < E::NUM; ++i)
+        Visit(static_cast<E::enum_type>(i), visitor);
+}
+
+template <EnumMetaMap E>
+template <class Visitor>
+void DBInstance<E>::SnapshotView::VisitRaw(E::enum_type e, Visitor &visitor) const
+{
+    visitor(e, E::META_MAP[e], entry_data(e));
+}
+
+template <EnumMetaMap E>
+template <class Visitor>
+void DBInstance<E>::SnapshotView::VisitRawEach(Visitor &visitor) const
+{
+    for (size_t i = 0; i < E::NUM; ++i)
+        VisitRaw(static_cast<E::enum_type>(i), visitor);
+}
+
+template <EnumMetaMap E>
+template <class T>
+typename DBInstance<E>::template ReadLease<T> DBInstance<E>::Read(E::enum_type e)
+{
+    SHOOBY_ASSERT(m_is_initialized, "DB not initialized!");
+    bool valid = check_get_type<T>(e);
+    count_stat(e, &KeyStats::gets);
+    return ReadLease<T>(*this, e, valid);
+}
+
+template <EnumMetaMap E>
+template <class T>
+typename DBInstance<E>::template WriteLease<T> DBInstance<E>::Write(E::enum_type e)
+{
+    SHOOBY_ASSERT(m_is_initialized, "DB not initialized!");
+    return WriteLease<T>(*this, e, check_get_type<T>(e));
+}
+
+template <EnumMetaMap E>
+template <class T>
+DBInstance<E>::ReadLease<T>::ReadLease(DBInstance &db, E::enum_type e, bool valid) : ref{}
+{
+    // T doesn't match the entry, referencing sizeof(T) bytes of it would overrun it
+    if (not valid)
+        return;
+
+    lock.emplace(db, LEASE, e);
+    if constexpr (std::is_same_v<T, std::string_view>)
+        ref = std::string_view((const char *)db.entry_data(e), DBInstance::string_length(db.entry_data(e)));
+    else
+        ref = reinterpret_cast<const T *>(db.entry_data(e));
+}
+
+template <EnumMetaMap E>
+template <class T>
+DBInstance<E>::WriteLease<T>::WriteLease(DBInstance &db, E::enum_type e, bool valid) : db(db), e(e), value(nullptr)
+{
+    // T doesn't match the entry, copying sizeof(T) bytes in and out would overrun it
+    if (not valid)
+        return;
+
+    SHOOBY_LOCK_EXCLUSIVE(db.get_stripe(e).mutex);
+    timer.Acquired();
+    value = reinterpret_cast<T *>(staged ? copy : db.entry_data(e));
+    memcpy(original, db.entry_data(e), sizeof(T));
+    if constexpr (staged)
+        memcpy(copy, original, sizeof(T));
+}
+
+template <EnumMetaMap E>
+template <class T>
+DBInstance<E>::WriteLease<T>::~WriteLease()
+{
+    if (value == nullptr)
+        return;
+
+    bool changed = memcmp(value, original, sizeof(T)) != 0;
+    if (changed && not DBInstance::in_range(e, value))
+    {
+        SHOOBY_DEBUG_PRINT("value out of allowed range! reverting\n");
+        memcpy(value, original, sizeof(T));
+        changed = false;
+    }
+
+    db.count_stat(e, &KeyStats::sets);
+    if (changed)
+    {
+        if constexpr (staged)
+            db.write_entry(e, value, sizeof(T));
+
+        db.mark_modified(e);
+        db.persist(e);
+        db.count_stat(e, &KeyStats::changed);
+    }
+
+    db.lock_released(timer, LEASE, e);
+    SHOOBY_UNLOCK_EXCLUSIVE(db.get_stripe(e).mutex);
+    if (changed)
+        db.auto_flush();
+
+    db.notify(e, changed);
+}
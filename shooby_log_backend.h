@@ -0,0 +1,388 @@
+#ifndef _SHOOBY_LOG_BACKEND_H_
+#define _SHOOBY_LOG_BACKEND_H_
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "shooby_db.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace Shooby
+{
+
+    /*
+        Reference log structured file backend.
+
+        The file starts with [magic: u32][version: u32], then every save appends one record:
+        [name length: u32][length: u32][name][payload: length bytes][crc32 of everything before: u32]
+        Records are keyed by the entry name itself, integers are stored in host byte order.
+        A file with another magic or version is not replayed, it is started over.
+
+        Init replays the log and keeps the latest value of every key in memory, Load is served from there.
+        Replay stops at the first incomplete or corrupted record and truncates the file there,
+        so a write torn by a crash or power loss loses only that record.
+
+        Once the log grows past compact_threshold bytes a background thread rewrites it with only the
+        latest record of every key, into a temporary file that is renamed over the log.
+
+        example usage:
+        Shooby::LogBackend backend("/data/connectivity.log");
+        Shooby::DB<CONNECTIVITY_CONFIG>::Init(&backend);
+    */
+    class LogBackend : public IBackend
+    {
+    public:
+        // sync_writes: fsync after every append. slower, but a returned Save survives power loss
+        LogBackend(const char *log_path, size_t compact_threshold = 64 * 1024, bool sync_writes = true)
+            : path(log_path), temp_path(path + ".tmp"), threshold(compact_threshold), sync(sync_writes), compact_at(compact_threshold) {}
+
+        ~LogBackend() override
+        {
+            if (compactor.joinable())
+            {
+                {
+                    std::lock_guard lock(mutex);
+                    stop = true;
+                }
+                wake.notify_one();
+                compactor.join();
+            }
+
+            if (file != nullptr)
+                fclose(file);
+        }
+
+        LogBackend(const LogBackend &) = delete;
+        LogBackend &operator=(const LogBackend &) = delete;
+
+        // called again when a DB is re-Initialized, the log is replayed and reopened
+        void Init() override
+        {
+            std::unique_lock lock(mutex);
+
+            // a running compaction swaps the file when it's done, let it finish first
+            wake.wait(lock, [this]
+                      { return not compacting; });
+
+            if (file != nullptr)
+                fclose(file);
+
+            replay();
+            file = fopen(path.c_str(), "ab");
+            SHOOBY_ASSERT(file != nullptr, "shooby_log_backend: can't open log");
+            if (log_size == 0)
+            {
+                if (not write_file_header(file))
+                    SHOOBY_DEBUG_PRINT("shooby_log_backend: can't write log header\n");
+
+                sync_file(file);
+                log_size = sizeof(FileHeader);
+            }
+
+            if (not compactor.joinable())
+                compactor = std::thread(&LogBackend::compactor_main, this);
+        }
+
+        void Save(const char *e_name, const void *data, size_t size) override
+        {
+            std::lock_guard lock(mutex);
+            append(e_name, data, size);
+            commit();
+        }
+
+        // all records of a batch are appended with one flush
+        void SaveBatch(std::span<const BackendEntry> entries) override
+        {
+            std::lock_guard lock(mutex);
+            for (const BackendEntry &entry : entries)
+                append(entry.name, entry.data, entry.size);
+            commit();
+        }
+
+        bool Load(const char *e_name, void *data, size_t size) override
+        {
+            std::lock_guard lock(mutex);
+            auto it = values.find(e_name);
+            if (it == values.end() || it->second.size() != size)
+                return false;
+
+            memcpy(data, it->second.data(), size);
+            return true;
+        }
+
+        // rewrites the log with only the latest record of every key
+        void Compact()
+        {
+            std::unique_lock lock(mutex);
+            compact(lock);
+        }
+
+        size_t LogSize() const
+        {
+            std::lock_guard lock(mutex);
+            return log_size;
+        }
+
+    private:
+        struct FileHeader
+        {
+            uint32_t magic;
+            uint32_t version;
+        };
+
+        static constexpr uint32_t LOG_MAGIC = 0x474C4853; // "SHLG"
+        static constexpr uint32_t LOG_VERSION = 2;
+
+        struct RecordHeader
+        {
+            uint32_t name_length;
+            uint32_t length;
+        };
+
+        static size_t record_size(const std::string &name, size_t size)
+        {
+            return sizeof(RecordHeader) + name.size() + size + sizeof(uint32_t);
+        }
+
+        static bool write_file_header(FILE *f)
+        {
+            FileHeader header{LOG_MAGIC, LOG_VERSION};
+            return fwrite(&header, sizeof(header), 1, f) == 1;
+        }
+
+        static bool write_record(FILE *f, const std::string &name, const void *data, size_t size)
+        {
+            RecordHeader header{static_cast<uint32_t>(name.size()), static_cast<uint32_t>(size)};
+            uint32_t crc = crc32(&header, sizeof(header));
+            crc = crc32(name.data(), name.size(), crc);
+            crc = crc32(data, size, crc);
+
+            return fwrite(&header, sizeof(header), 1, f) == 1 &&
+                   fwrite(name.data(), name.size(), 1, f) == 1 &&
+                   (size == 0 || fwrite(data, size, 1, f) == 1) &&
+                   fwrite(&crc, sizeof(crc), 1, f) == 1;
+        }
+
+        static void sync_file(FILE *f)
+        {
+            fflush(f);
+#if defined(__unix__) || defined(__APPLE__)
+            fsync(fileno(f));
+#endif
+        }
+
+        // makes a rename in the directory of file_path durable
+        static void sync_dir(const std::string &file_path)
+        {
+#if defined(__unix__) || defined(__APPLE__)
+            std::string dir = std::filesystem::path(file_path).parent_path().string();
+            int fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY);
+            if (fd < 0)
+                return;
+
+            fsync(fd);
+            close(fd);
+#endif
+        }
+
+        // rebuilds values from the log, must be called with mutex locked
+        void replay()
+        {
+            values.clear();
+            log_size = 0;
+
+            FILE *f = fopen(path.c_str(), "rb");
+            if (f == nullptr)
+                return;
+
+            std::vector<uint8_t> log;
+            uint8_t chunk[512];
+            size_t read;
+            while ((read = fread(chunk, 1, sizeof(chunk), f)) > 0)
+                log.insert(log.end(), chunk, chunk + read);
+            fclose(f);
+
+            FileHeader file_header{};
+            if (log.size() >= sizeof(file_header))
+                memcpy(&file_header, log.data(), sizeof(file_header));
+
+            // an empty file or one of another format, started over by Init
+            if (file_header.magic != LOG_MAGIC || file_header.version != LOG_VERSION)
+            {
+                if (not log.empty())
+                    SHOOBY_DEBUG_PRINT("shooby_log_backend: not a version %u log, starting over\n", LOG_VERSION);
+
+                std::error_code ec;
+                std::filesystem::resize_file(path, 0, ec);
+                return;
+            }
+
+            size_t offset = sizeof(FileHeader);
+            while (offset + sizeof(RecordHeader) + sizeof(uint32_t) <= log.size())
+            {
+                RecordHeader header;
+                memcpy(&header, log.data() + offset, sizeof(header));
+                size_t available = log.size() - offset - sizeof(RecordHeader) - sizeof(uint32_t);
+                if (header.name_length > available || header.length > available - header.name_length)
+                    break;
+
+                const char *name = reinterpret_cast<const char *>(log.data() + offset + sizeof(RecordHeader));
+                const uint8_t *payload = log.data() + offset + sizeof(RecordHeader) + header.name_length;
+                uint32_t stored_crc;
+                memcpy(&stored_crc, payload + header.length, sizeof(stored_crc));
+                if (stored_crc != crc32(log.data() + offset, sizeof(RecordHeader) + header.name_length + header.length))
+                    break;
+
+                values[std::string(name, header.name_length)].assign(payload, payload + header.length);
+                offset += sizeof(RecordHeader) + header.name_length + header.length + sizeof(uint32_t);
+            }
+
+            if (offset != log.size())
+            {
+                SHOOBY_DEBUG_PRINT("shooby_log_backend: dropping %zu bytes of torn tail\n", log.size() - offset);
+                std::error_code ec;
+                std::filesystem::resize_file(path, offset, ec);
+            }
+
+            log_size = offset;
+        }
+
+        // must be called with mutex locked
+        void append(const char *e_name, const void *data, size_t size)
+        {
+            SHOOBY_ASSERT(file != nullptr, "shooby_log_backend: not initialized");
+            std::string name(e_name);
+            const uint8_t *bytes = static_cast<const uint8_t *>(data);
+            values[name].assign(bytes, bytes + size);
+
+            if (not write_record(file, name, data, size))
+                SHOOBY_DEBUG_PRINT("shooby_log_backend: append failed\n");
+
+            log_size += record_size(name, size);
+            if (compacting)
+                saved_while_compacting.push_back(std::move(name));
+        }
+
+        // must be called with mutex locked
+        void commit()
+        {
+            if (sync)
+                sync_file(file);
+            else
+                fflush(file);
+
+            if (log_size > compact_at && not compacting)
+                wake.notify_one();
+        }
+
+        // writes a snapshot of values to the temp file without holding the mutex,
+        // then appends whatever was saved meanwhile and swaps the files under the mutex
+        void compact(std::unique_lock<std::mutex> &lock)
+        {
+            if (compacting)
+                return;
+
+            compacting = true;
+            auto snapshot = values;
+            lock.unlock();
+
+            FILE *temp = fopen(temp_path.c_str(), "wb");
+            size_t temp_size = sizeof(FileHeader);
+            bool ok = temp != nullptr && write_file_header(temp);
+            for (const auto &[name, value] : snapshot)
+            {
+                ok = ok && write_record(temp, name, value.data(), value.size());
+                temp_size += record_size(name, value.size());
+            }
+
+            lock.lock();
+            for (const std::string &name : saved_while_compacting)
+            {
+                const auto &value = values[name];
+                ok = ok && write_record(temp, name, value.data(), value.size());
+                temp_size += record_size(name, value.size());
+            }
+            saved_while_compacting.clear();
+            compacting = false;
+            wake.notify_all();
+
+            if (temp != nullptr)
+            {
+                sync_file(temp);
+                fclose(temp);
+            }
+
+            std::error_code ec;
+            if (ok)
+                std::filesystem::rename(temp_path, path, ec);
+
+            if (not ok || ec)
+            {
+                SHOOBY_DEBUG_PRINT("shooby_log_backend: compaction failed, keeping the old log\n");
+                std::filesystem::remove(temp_path, ec);
+
+                // retry only after another threshold of saves, not in a loop on a failing file system
+                compact_at = log_size + threshold;
+                return;
+            }
+
+            // without it a power loss can bring back the directory entry of the old log
+            if (sync)
+                sync_dir(path);
+
+            // if the live data alone is above the threshold, don't compact again on every save
+            compact_at = std::max(threshold, 2 * temp_size);
+
+            fclose(file);
+            file = fopen(path.c_str(), "ab");
+            SHOOBY_ASSERT(file != nullptr, "shooby_log_backend: can't reopen log");
+            log_size = temp_size;
+            SHOOBY_DEBUG_PRINT("shooby_log_backend: compacted to %zu bytes\n", log_size);
+        }
+
+        void compactor_main()
+        {
+            std::unique_lock lock(mutex);
+            while (true)
+            {
+                wake.wait(lock, [this]
+                          { return stop || log_size > compact_at; });
+                if (stop)
+                    break;
+
+                compact(lock);
+            }
+        }
+
+        const std::string path;
+        const std::string temp_path;
+        const size_t threshold;
+        const bool sync;
+
+        mutable std::mutex mutex{};
+        FILE *file = nullptr;
+        size_t log_size = 0;
+        std::unordered_map<std::string, std::vector<uint8_t>> values{};
+
+        size_t compact_at;
+        bool compacting = false;
+        std::vector<std::string> saved_while_compacting{};
+
+        std::condition_variable wake{};
+        bool stop = false;
+        std::thread compactor{};
+    };
+
+} // namespace Shooby
+
+#endif
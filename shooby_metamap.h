@@ -32,6 +32,14 @@
     {#ENUM, SIZE, DEFAULT},
 #define SHOOBY_TO_META_BLOB(ENUM, TYPE, ...) \
     {#ENUM, &def_##ENUM},
+
+// declarations only, DB::Get<KEY>() and DB::Set<KEY>() take the value type from their return type
+#define SHOOBY_TO_TYPE_ARITHMETIC(ENUM, TYPE, ...) \
+    static TYPE shooby_type_of(std::integral_constant<enum_type, ENUM>);
+#define SHOOBY_TO_TYPE_STRING(ENUM, ...) \
+    static const char *shooby_type_of(std::integral_constant<enum_type, ENUM>);
+#define SHOOBY_TO_TYPE_BLOB(ENUM, TYPE, ...) \
+    static TYPE shooby_type_of(std::integral_constant<enum_type, ENUM>);
 //=====================================================================
 
 #define DEFINE_SHOOBY_META_MAP(CONFIG_LIST)                                                          \
@@ -50,6 +58,9 @@
         /*STATIC ALLOCATE BLOBS IN STRUCT*/                                                          \
         CONFIG_LIST(SHOOBY_NOTHING, SHOOBY_NOTHING, SHOOBY_STATIC_ALLOCATE_BLOB)                     \
                                                                                                      \
+        /*VALUE TYPE OF EVERY KEY*/                                                                  \
+        CONFIG_LIST(SHOOBY_TO_TYPE_ARITHMETIC, SHOOBY_TO_TYPE_STRING, SHOOBY_TO_TYPE_BLOB)           \
+                                                                                                     \
         static inline constexpr Shooby::MetaData META_MAP[NUM] =                                     \
             {                                                                                        \
                 CONFIG_LIST(SHOOBY_TO_META_ARITHMETIC, SHOOBY_TO_META_STRING, SHOOBY_TO_META_BLOB)}; \
@@ -0,0 +1,121 @@
+#ifndef _SHOOBY_MMAP_H_
+#define _SHOOBY_MMAP_H_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "shooby_utilities.h"
+
+namespace Shooby
+{
+
+    /*
+        A DB data buffer image inside a memory mapped file (POSIX).
+
+        File layout: [Header, padded to 64 bytes][data buffer]
+        The header is only valid for the same magic, version, schema fingerprint and data size,
+        otherwise the caller is expected to load defaults into Data() and call Stamp().
+        Changes are persisted by msync of the pages that hold them.
+    */
+    class MappedImage
+    {
+    public:
+        static constexpr uint32_t MAGIC = 0x5348424D; // "SHBM"
+        static constexpr uint32_t VERSION = 1;
+
+        MappedImage() = default;
+        ~MappedImage() { Close(); }
+
+        MappedImage(const MappedImage &) = delete;
+        MappedImage &operator=(const MappedImage &) = delete;
+
+        // maps the file, creating or resizing it as needed. returns false if the file can't be mapped
+        bool Open(const char *path, uint32_t fingerprint, size_t data_size)
+        {
+            Close();
+
+            int fd = open(path, O_RDWR | O_CREAT, 0644);
+            if (fd < 0)
+                return false;
+
+            struct stat st;
+            size_t total = DATA_OFFSET + data_size;
+            bool size_matches = fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) == total;
+            if (not size_matches && ftruncate(fd, total) != 0)
+            {
+                ::close(fd);
+                return false;
+            }
+
+            void *mapped = mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (mapped == MAP_FAILED)
+                return false;
+
+            base = static_cast<uint8_t *>(mapped);
+            mapped_size = total;
+            expected = Header{MAGIC, VERSION, fingerprint, static_cast<uint32_t>(data_size)};
+
+            Header header;
+            memcpy(&header, base, sizeof(header));
+            valid = size_matches && memcmp(&header, &expected, sizeof(header)) == 0;
+            return true;
+        }
+
+        void Close()
+        {
+            if (base == nullptr)
+                return;
+
+            msync(base, mapped_size, MS_SYNC);
+            munmap(base, mapped_size);
+            base = nullptr;
+            valid = false;
+        }
+
+        bool Mapped() const { return base != nullptr; }
+
+        // true if the file held an image with the same layout when it was opened
+        bool Valid() const { return valid; }
+
+        uint8_t *Data() { return base + DATA_OFFSET; }
+
+        // marks the image as valid after the data was initialized, and syncs the whole file
+        void Stamp()
+        {
+            memcpy(base, &expected, sizeof(expected));
+            msync(base, mapped_size, MS_SYNC);
+            valid = true;
+        }
+
+        // syncs the pages holding data bytes [offset, offset + size)
+        void Sync(size_t offset, size_t size, int flags = MS_SYNC)
+        {
+            static const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+            size_t start = (DATA_OFFSET + offset) & ~(page - 1);
+            size_t end = DATA_OFFSET + offset + size;
+            msync(base + start, end - start, flags);
+        }
+
+    private:
+        struct Header
+        {
+            uint32_t magic;
+            uint32_t version;
+            uint32_t fingerprint;
+            uint32_t data_size;
+        };
+
+        static constexpr size_t DATA_OFFSET = 64;
+        static_assert(sizeof(Header) <= DATA_OFFSET);
+
+        uint8_t *base = nullptr;
+        size_t mapped_size = 0;
+        Header expected{};
+        bool valid = false;
+    };
+
+} // namespace Shooby
+
+#endif
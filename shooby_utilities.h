@@ -3,9 +3,15 @@
 
 #include <type_traits>
 #include <concepts>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
 #include <variant>
 #include <cstdint>
+#include <cstddef>
 #include <cstring>
+#include <string_view>
 #include "shooby_config.h"
 
 //================ UTILITY ALIASES =================
@@ -41,14 +47,139 @@ namespace Shooby
 
     // ================== UTILITY FUNCTIONS =================
 
+    // FNV-1a hash, used for key ids and schema fingerprints
+    static inline uint32_t fnv1a(const void *data, size_t size, uint32_t hash = 2166136261u)
+    {
+        const uint8_t *bytes = static_cast<const uint8_t *>(data);
+        for (size_t i = 0; i < size; i++)
+            hash = (hash ^ bytes[i]) * 16777619u;
+
+        return hash;
+    }
+
+    static constexpr uint32_t fnv1a(const char *str, uint32_t hash = 2166136261u)
+    {
+        while (*str != '\0')
+            hash = (hash ^ static_cast<uint8_t>(*str++)) * 16777619u;
+
+        return hash;
+    }
+
+    static constexpr uint32_t fnv1a(uint32_t value, uint32_t hash)
+    {
+        for (int i = 0; i < 4; i++, value >>= 8)
+            hash = (hash ^ (value & 0xFF)) * 16777619u;
+
+        return hash;
+    }
+
+    // CRC-32 (IEEE 802.3), pass the previous result as crc to continue a running checksum
+    static inline uint32_t crc32(const void *data, size_t size, uint32_t crc = 0)
+    {
+        static constexpr auto table = []
+        {
+            std::array<uint32_t, 256> t{};
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++)
+                    c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                t[i] = c;
+            }
+            return t;
+        }();
+
+        const uint8_t *bytes = static_cast<const uint8_t *>(data);
+        crc = ~crc;
+        for (size_t i = 0; i < size; i++)
+            crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+
+        return ~crc;
+    }
+
+    // string entries are stored as [length: string_length_t][chars, NUL terminated]
+    using string_length_t = uint16_t;
+
+    // bytes stored before the value of entry i
+    template <EnumMetaMap T>
+    static constexpr size_t entry_prefix_size(size_t i)
+    {
+        return std::holds_alternative<const char *>(T::META_MAP[i].default_val) ? sizeof(string_length_t) : 0;
+    }
+
+    // offset of the value of every entry inside the data buffer, entries are laid out in META_MAP order,
+    // each one at its natural alignment so it can be referenced in place
+    template <EnumMetaMap T>
+    static consteval std::array<size_t, T::NUM> offsets_table()
+    {
+        std::array<size_t, T::NUM> offsets{};
+        size_t offset = 0;
+        for (size_t i = 0; i < T::NUM; i++)
+        {
+            size_t alignment = T::META_MAP[i].alignment;
+            offset = (offset + alignment - 1) / alignment * alignment;
+            offset += entry_prefix_size<T>(i);
+            offsets[i] = offset;
+            offset += T::META_MAP[i].size;
+        }
+
+        return offsets;
+    }
+
     template <EnumMetaMap T>
     static consteval size_t required_buffer_size()
     {
-        size_t size = 0;
+        return offsets_table<T>()[T::NUM - 1] + T::META_MAP[T::NUM - 1].size;
+    }
+
+    // alignment of the data buffer, the biggest alignment of an entry
+    template <EnumMetaMap T>
+    static consteval size_t max_entry_alignment()
+    {
+        size_t max = 1;
+        for (size_t i = 0; i < T::NUM; i++)
+            max = T::META_MAP[i].alignment > max ? T::META_MAP[i].alignment : max;
+
+        return max;
+    }
+
+    // hash of the META_MAP layout: name, size, alignment and value type of every entry in order.
+    // persisted images of the data buffer are only valid for the same fingerprint
+    template <EnumMetaMap T>
+    static consteval uint32_t schema_fingerprint()
+    {
+        uint32_t hash = 2166136261u;
         for (size_t i = 0; i < T::NUM; i++)
-            size += T::META_MAP[i].size;
+        {
+            hash = fnv1a(T::META_MAP[i].name, hash);
+            hash = fnv1a(static_cast<uint32_t>(entry_prefix_size<T>(i) + T::META_MAP[i].size), hash);
+            hash = fnv1a(static_cast<uint32_t>(T::META_MAP[i].alignment), hash);
+            hash = fnv1a(static_cast<uint32_t>(T::META_MAP[i].default_val.index()), hash);
+        }
 
-        return size;
+        return hash;
+    }
+
+    // type of the value of key K wrapped in std::type_identity. blob types are only known from the
+    // shooby_type_of declarations of DEFINE_SHOOBY_META_MAP, otherwise the META_MAP variant type is used
+    template <EnumMetaMap T, typename T::enum_type K>
+    static consteval auto key_type_tag()
+    {
+        if constexpr (requires { T::shooby_type_of(std::integral_constant<typename T::enum_type, K>{}); })
+            return std::type_identity<decltype(T::shooby_type_of(std::integral_constant<typename T::enum_type, K>{}))>{};
+        else
+            return std::type_identity<std::variant_alternative_t<T::META_MAP[K].default_val.index(), value_variant_t>>{};
+    }
+
+    // size of the biggest entry, used for stack copies of a single entry
+    template <EnumMetaMap T>
+    static consteval size_t max_entry_size()
+    {
+        size_t max = 0;
+        for (size_t i = 0; i < T::NUM; i++)
+            max = T::META_MAP[i].size > max ? T::META_MAP[i].size : max;
+
+        return max;
     }
 
     //================ UTILITY CLASSES =================
@@ -58,25 +189,32 @@ namespace Shooby
     {
     public:
         FixedString() = default;
-        FixedString(const char *str) { std::strncpy(buffer, str, N); }
-        FixedString(const FixedString &other) { std::strncpy(buffer, other.buffer, N); }
-        FixedString(FixedString &&other) { buffer = std::move(other.buffer); }
-
-        FixedString &operator=(const FixedString &other)
+        FixedString(const char *str) : FixedString(str, strnlen(str, N - 1)) {}
+        FixedString(const char *str, size_t len) : length(len < N ? len : N - 1)
         {
-            std::strncpy(buffer, other.buffer, N);
-            return *this;
+            // copies only the live bytes
+            memcpy(buffer, str, length);
+            buffer[length] = '\0';
         }
 
-        FixedString &operator=(FixedString &&other)
+        FixedString(const FixedString &other) : FixedString(other.buffer, other.length) {}
+        FixedString(FixedString &&other) : FixedString(other.buffer, other.length) {}
+
+        FixedString &operator=(const FixedString &other)
         {
-            std::strncpy(buffer, other.buffer, N);
+            length = other.length;
+            memcpy(buffer, other.buffer, length + 1);
             return *this;
         }
 
+        FixedString &operator=(FixedString &&other) { return *this = other; }
+
         const char *c_str() const { return buffer; }
+        size_t size() const { return length; }
+        std::string_view view() const { return {buffer, length}; }
 
     private:
+        size_t length = 0;
         char buffer[N]{};
     };
 
@@ -105,10 +243,11 @@ namespace Shooby
 
     */
 
+    template <class Mutex = SHOOBY_MUTEX_TYPE>
     class Lock
     {
     public:
-        Lock(SHOOBY_MUTEX_TYPE &m) : locked(m) { SHOOBY_LOCK(locked); }
+        Lock(Mutex &m) : locked(m) { SHOOBY_LOCK(locked); }
         ~Lock() { SHOOBY_UNLOCK(locked); }
 
         Lock(const Lock &) = delete;
@@ -117,9 +256,414 @@ namespace Shooby
         Lock &operator=(Lock &&) = delete;
 
     private:
-        SHOOBY_MUTEX_TYPE &locked;
+        Mutex &locked;
+    };
+
+    // write lock of the reader-writer mutex
+    template <class Mutex = SHOOBY_SHARED_MUTEX_TYPE>
+    class ExclusiveLock
+    {
+    public:
+        ExclusiveLock(Mutex &m) : locked(m) { SHOOBY_LOCK_EXCLUSIVE(locked); }
+        ~ExclusiveLock() { SHOOBY_UNLOCK_EXCLUSIVE(locked); }
+
+        ExclusiveLock(const ExclusiveLock &) = delete;
+        ExclusiveLock &operator=(const ExclusiveLock &) = delete;
+        ExclusiveLock(ExclusiveLock &&) = delete;
+        ExclusiveLock &operator=(ExclusiveLock &&) = delete;
+
+    private:
+        Mutex &locked;
+    };
+
+    template <class Mutex = SHOOBY_SHARED_MUTEX_TYPE>
+    class SharedLock
+    {
+    public:
+        SharedLock(Mutex &m) : locked(m) { SHOOBY_LOCK_SHARED(locked); }
+        ~SharedLock() { SHOOBY_UNLOCK_SHARED(locked); }
+
+        SharedLock(const SharedLock &) = delete;
+        SharedLock &operator=(const SharedLock &) = delete;
+        SharedLock(SharedLock &&) = delete;
+        SharedLock &operator=(SharedLock &&) = delete;
+
+    private:
+        Mutex &locked;
+    };
+
+    // fixed size bitset whose bits can be set and cleared concurrently without a lock
+    template <size_t N>
+    class AtomicBitset
+    {
+    public:
+        // returns the previous value of the bit
+        bool Set(size_t i)
+        {
+            return words[i / 32].fetch_or(mask(i), std::memory_order_acq_rel) & mask(i);
+        }
+
+        // returns the previous value of the bit
+        bool Reset(size_t i)
+        {
+            return words[i / 32].fetch_and(~mask(i), std::memory_order_acq_rel) & mask(i);
+        }
+
+        bool Test(size_t i) const
+        {
+            return words[i / 32].load(std::memory_order_acquire) & mask(i);
+        }
+
+        size_t Count() const
+        {
+            size_t count = 0;
+            for (const auto &word : words)
+                count += std::popcount(word.load(std::memory_order_relaxed));
+
+            return count;
+        }
+
+    private:
+        static constexpr uint32_t mask(size_t i) { return uint32_t(1) << (i % 32); }
+        std::atomic<uint32_t> words[(N + 31) / 32]{};
+    };
+
+    /*
+        Sequence counter for lock free readers.
+        Writers must be serialized externally (by the DB mutex) and wrap every buffer write
+        with WriteBegin/WriteEnd. Readers copy the data between ReadBegin and ReadRetry
+        and start over if ReadRetry returns true.
+
+        example usage:
+        uint32_t seq;
+        do
+        {
+            seq = seqlock.ReadBegin();
+            memcpy(dst, src, size);
+        } while (seqlock.ReadRetry(seq));
+    */
+    class SeqLock
+    {
+    public:
+        void WriteBegin()
+        {
+            sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        void WriteEnd()
+        {
+            sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        uint32_t ReadBegin() const
+        {
+            uint32_t seq;
+            // odd sequence means a write is in progress
+            while ((seq = sequence.load(std::memory_order_acquire)) & 1)
+                ;
+
+            return seq;
+        }
+
+        bool ReadRetry(uint32_t seq) const
+        {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return sequence.load(std::memory_order_relaxed) != seq;
+        }
+
+    private:
+        std::atomic<uint32_t> sequence{0};
+    };
+
+    // bounded multi producer multi consumer queue without locks (D. Vyukov's array queue).
+    // every cell carries a sequence number telling producers and consumers whose turn it is
+    template <class T, size_t N>
+    class MpmcQueue
+    {
+        static_assert(N >= 2 && std::has_single_bit(N), "queue size must be a power of 2");
+
+    public:
+        MpmcQueue()
+        {
+            for (size_t i = 0; i < N; i++)
+                cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        // returns false if the queue is full
+        bool TryPush(const T &t)
+        {
+            size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+            while (true)
+            {
+                Cell &cell = cells[pos & (N - 1)];
+                size_t seq = cell.sequence.load(std::memory_order_acquire);
+                intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+                if (diff == 0)
+                {
+                    if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        cell.data = t;
+                        cell.sequence.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (diff < 0)
+                    return false;
+                else
+                    pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+
+        // returns false if the queue is empty
+        bool TryPop(T &t)
+        {
+            size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+            while (true)
+            {
+                Cell &cell = cells[pos & (N - 1)];
+                size_t seq = cell.sequence.load(std::memory_order_acquire);
+                intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+                if (diff == 0)
+                {
+                    if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        t = cell.data;
+                        cell.sequence.store(pos + N, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (diff < 0)
+                    return false;
+                else
+                    pos = dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+
+        // approximate while producers or consumers are running
+        size_t Size() const
+        {
+            size_t tail = dequeue_pos.load(std::memory_order_relaxed);
+            size_t head = enqueue_pos.load(std::memory_order_relaxed);
+            return head > tail ? head - tail : 0;
+        }
+
+    private:
+        struct Cell
+        {
+            std::atomic<size_t> sequence;
+            T data;
+        };
+
+        Cell cells[N];
+        alignas(64) std::atomic<size_t> enqueue_pos{0};
+        alignas(64) std::atomic<size_t> dequeue_pos{0};
+    };
+
+    /*
+        Copies of a 1, 2 or 4 byte value at its natural alignment with a single atomic load or store,
+        so a lock free reader never sees it torn. The bytes are moved as an unsigned word of the same size.
+    */
+    template <class W>
+    W atomic_load_word(const void *src)
+    {
+        return std::atomic_ref<W>(*static_cast<W *>(const_cast<void *>(src))).load(std::memory_order_acquire);
+    }
+
+    template <class W>
+    void atomic_store_word(void *dst, W w)
+    {
+        std::atomic_ref<W>(*static_cast<W *>(dst)).store(w, std::memory_order_release);
+    }
+
+    inline void atomic_load_bytes(void *dst, const void *src, size_t size)
+    {
+        switch (size)
+        {
+        case 1:
+            *static_cast<uint8_t *>(dst) = atomic_load_word<uint8_t>(src);
+            break;
+        case 2:
+        {
+            uint16_t w = atomic_load_word<uint16_t>(src);
+            memcpy(dst, &w, sizeof(w));
+            break;
+        }
+        default:
+        {
+            uint32_t w = atomic_load_word<uint32_t>(src);
+            memcpy(dst, &w, sizeof(w));
+            break;
+        }
+        }
+    }
+
+    inline void atomic_store_bytes(void *dst, const void *src, size_t size)
+    {
+        switch (size)
+        {
+        case 1:
+            atomic_store_word<uint8_t>(dst, *static_cast<const uint8_t *>(src));
+            break;
+        case 2:
+        {
+            uint16_t w;
+            memcpy(&w, src, sizeof(w));
+            atomic_store_word<uint16_t>(dst, w);
+            break;
+        }
+        default:
+        {
+            uint32_t w;
+            memcpy(&w, src, sizeof(w));
+            atomic_store_word<uint32_t>(dst, w);
+            break;
+        }
+        }
+    }
+
+    // steady clock in nanoseconds, for latency measurements
+    inline uint64_t monotonic_ns()
+    {
+        auto now = std::chrono::steady_clock::now().time_since_epoch();
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
+    }
+
+    // raises a to v when v is larger, concurrent recorders can't lower a max another one stored
+    template <class T>
+    inline void atomic_store_max(std::atomic<T> &a, std::type_identity_t<T> v)
+    {
+        T current = a.load(std::memory_order_relaxed);
+        while (v > current && not a.compare_exchange_weak(current, v, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    // latency histogram of fixed power of 2 buckets with relaxed atomic counters, never blocks a recorder.
+    // bucket i counts durations below BucketLimitNs(i), the last bucket everything longer
+    class LatencyHistogram
+    {
+    public:
+        static constexpr size_t BUCKETS = 20;
+        static constexpr uint64_t BucketLimitNs(size_t i) { return uint64_t(64) << i; }
+
+        // a copy of the counters, fields are read one by one while recorders may run
+        struct Counts
+        {
+            uint64_t buckets[BUCKETS];
+            uint64_t count;
+            uint64_t total_ns;
+            uint64_t max_ns;
+        };
+
+        void Record(uint64_t ns)
+        {
+            size_t bucket = std::bit_width(ns >> 6);
+            buckets[bucket < BUCKETS ? bucket : BUCKETS - 1].fetch_add(1, std::memory_order_relaxed);
+            total_ns.fetch_add(ns, std::memory_order_relaxed);
+            atomic_store_max(max_ns, ns);
+        }
+
+        Counts Load() const
+        {
+            Counts counts{};
+            for (size_t i = 0; i < BUCKETS; i++)
+            {
+                counts.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+                counts.count += counts.buckets[i];
+            }
+
+            counts.total_ns = total_ns.load(std::memory_order_relaxed);
+            counts.max_ns = max_ns.load(std::memory_order_relaxed);
+            return counts;
+        }
+
+        void Reset()
+        {
+            for (auto &bucket : buckets)
+                bucket.store(0, std::memory_order_relaxed);
+
+            total_ns.store(0, std::memory_order_relaxed);
+            max_ns.store(0, std::memory_order_relaxed);
+        }
+
+    private:
+        std::atomic<uint64_t> buckets[BUCKETS]{};
+        std::atomic<uint64_t> total_ns{0};
+        std::atomic<uint64_t> max_ns{0};
+    };
+
+    // wait and hold times of the locks taken at one call site, with relaxed atomic counters.
+    // the max hold time and its key share one word, so the key always belongs to the max
+    class LockProfile
+    {
+    public:
+        struct Counts
+        {
+            uint64_t acquisitions;
+            uint64_t total_wait_ns;
+            uint64_t max_wait_ns;
+            uint64_t total_hold_ns;
+            uint64_t max_hold_ns;
+            size_t max_hold_key;
+        };
+
+        void Record(uint64_t wait_ns, uint64_t hold_ns, size_t key)
+        {
+            acquisitions.fetch_add(1, std::memory_order_relaxed);
+            total_wait_ns.fetch_add(wait_ns, std::memory_order_relaxed);
+            total_hold_ns.fetch_add(hold_ns, std::memory_order_relaxed);
+            atomic_store_max(max_wait_ns, wait_ns);
+
+            // hold time in the high bits, a longer hold always compares larger whatever the keys
+            uint64_t hold = hold_ns < MAX_HOLD_NS ? hold_ns : MAX_HOLD_NS;
+            uint64_t key_bits = key < KEY_MASK ? key : KEY_MASK;
+            atomic_store_max(max_hold, (hold << KEY_BITS) | key_bits);
+        }
+
+        Counts Load() const
+        {
+            // one load, the hold time and the key come from the same record
+            uint64_t hold = max_hold.load(std::memory_order_relaxed);
+            return Counts{
+                .acquisitions = acquisitions.load(std::memory_order_relaxed),
+                .total_wait_ns = total_wait_ns.load(std::memory_order_relaxed),
+                .max_wait_ns = max_wait_ns.load(std::memory_order_relaxed),
+                .total_hold_ns = total_hold_ns.load(std::memory_order_relaxed),
+                .max_hold_ns = hold >> KEY_BITS,
+                .max_hold_key = unpack_key(hold),
+            };
+        }
+
+        void Reset()
+        {
+            acquisitions.store(0, std::memory_order_relaxed);
+            total_wait_ns.store(0, std::memory_order_relaxed);
+            max_wait_ns.store(0, std::memory_order_relaxed);
+            total_hold_ns.store(0, std::memory_order_relaxed);
+            max_hold.store(0, std::memory_order_relaxed);
+        }
+
+    private:
+        // 24 bits of key leave 40 bits of hold time, about 18 minutes
+        static constexpr unsigned KEY_BITS = 24;
+        static constexpr uint64_t KEY_MASK = (uint64_t(1) << KEY_BITS) - 1;
+        static constexpr uint64_t MAX_HOLD_NS = UINT64_MAX >> KEY_BITS;
+
+        // keys that don't fit are stored as KEY_MASK and read back as SIZE_MAX, like a whole DB lock
+        static size_t unpack_key(uint64_t packed)
+        {
+            uint64_t key = packed & KEY_MASK;
+            return key < KEY_MASK ? static_cast<size_t>(key) : SIZE_MAX;
+        }
+
+        std::atomic<uint64_t> acquisitions{0};
+        std::atomic<uint64_t> total_wait_ns{0};
+        std::atomic<uint64_t> max_wait_ns{0};
+        std::atomic<uint64_t> total_hold_ns{0};
+        std::atomic<uint64_t> max_hold{0};
     };
 
 } // namespace Shooby
 
-#endif
\ No newline at end of file
+#endif